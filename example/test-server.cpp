@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <algorithm>
 #include "server.h"
 
 int main(int argc, const char* argv[])
@@ -14,6 +15,8 @@ int main(int argc, const char* argv[])
         path = argv[2];
 
     http::server server;
+    if (argc > 3)
+        server.options().worker_count = strtol(argv[3], nullptr, 10);
 
 #ifdef _TEST_POST_
     http::router router =
@@ -41,6 +44,69 @@ int main(int argc, const char* argv[])
             sink(pstr->c_str(), pstr->size(), [pstr]() {});
         };
     });
+
+    // pushes lines until the sink returns false at the high watermark, called again from the offset when drained
+    server.serve("/lines", [&](const http::request2& req, http::response2& res) {
+        res.content_length = 10 * 1024 * 1024;
+        res.provider = [](int64_t offset, int64_t length, http::content_sink sink) {
+            static const std::string line = std::string(1023, '.') + '\n';
+            bool more = true;
+            while (more && offset < length)
+            {
+                size_t size = (size_t)std::min<int64_t>(line.size(), length - offset);
+                more = sink(line.c_str(), size, nullptr);
+                offset += size;
+            }
+        };
+    });
+#endif
+
+#ifdef _TEST_ROUTES_
+    // the literal "/route/index.html" first, then "/route/:page" for others as "/route/indexXhtml"
+    auto serve_text = [&server](const std::string& pattern, const std::string& text) {
+        server.serve(pattern, [text](const http::request2& req, http::response2& res) {
+            std::string content = text + (req.params.count("page") ? " " + req.params.at("page") : "");
+            auto pstr = std::make_shared<std::string>(std::move(content));
+            res.content_length = pstr->size();
+            res.provider = [pstr](int64_t offset, int64_t length, http::content_sink sink) {
+                sink(pstr->c_str() + offset, (size_t)(length - offset), [pstr]() {});
+            };
+        });
+    };
+    serve_text("/route/:page", "page");
+    serve_text("/route/index.html", "index");
+#endif
+
+#ifdef _TEST_PAUSE_
+    // never resumed, to be closed after body_timeout
+    server.options().body_timeout = 3 * 1000;
+    http::router paused_router =
+    {
+        [](const http::request2& req) {
+            req.pause();
+            return true;
+        },
+        [](const char* data, size_t size) {
+            return true;
+        },
+        [](const http::request2& req, http::response2& res) {
+        }
+    };
+    server.serve("/pause/.*", paused_router);
+#endif
+
+#ifdef _TEST_COMPRESS_
+    // the ETag of a compressed file is "xyz-gzip", sent back in If-None-Match to be answered 304
+    server.options().compression = true;
+#endif
+
+#ifdef _TEST_DEFER_
+    // never completed, to be answered 504 and closed after write_timeout
+    std::vector<std::shared_ptr<http::deferred_response>> never_completed;
+    server.options().write_timeout = 3 * 1000;
+    server.serve("/defer/never", [&](const http::request2& req, http::response2& res) {
+        never_completed.push_back(res.defer());
+    });
 #endif
 
     server.serve(".*", [&](const http::request2& req, http::response2& res) {
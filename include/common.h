@@ -3,11 +3,14 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <optional.hpp>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 namespace http
 {
@@ -15,18 +18,135 @@ namespace http
 static const std::string HEADER_ACCEPT_ENCODING     = "Accept-Encoding";
 static const std::string HEADER_ACCEPT_RANGES       = "Accept-Ranges";
 static const std::string HEADER_CONNECTION          = "Connection";
+static const std::string HEADER_CONTENT_ENCODING    = "Content-Encoding";
 static const std::string HEADER_CONTENT_LENGTH      = "Content-Length";
 static const std::string HEADER_CONTENT_RANGE       = "Content-Range";
 static const std::string HEADER_CONTENT_TYPE        = "Content-Type";
+static const std::string HEADER_DATE                = "Date";
+static const std::string HEADER_ETAG                = "ETag";
+static const std::string HEADER_LAST_MODIFIED       = "Last-Modified";
 static const std::string HEADER_LOCATION            = "Location";
 static const std::string HEADER_RANGE               = "Range";
 static const std::string HEADER_REMOTE_ADDRESS      = "Remote-Address";
 static const std::string HEADER_SERVER              = "Server";
 static const std::string HEADER_TRANSFER_ENCODING   = "Transfer-Encoding";
 static const std::string HEADER_USER_AGENT          = "User-Agent";
+static const std::string HEADER_VARY                = "Vary";
 
 static const std::string LIBHTTP_TAG = "libhttp/0.1";
 
+// well-known headers, looked up by a compile-time perfect hash while parsing
+enum header_id : int
+{
+    header_unknown = -1,
+    header_accept,
+    header_accept_encoding,
+    header_accept_language,
+    header_accept_ranges,
+    header_authorization,
+    header_cache_control,
+    header_connection,
+    header_content_encoding,
+    header_content_length,
+    header_content_range,
+    header_content_type,
+    header_cookie,
+    header_date,
+    header_etag,
+    header_expect,
+    header_host,
+    header_if_match,
+    header_if_modified_since,
+    header_if_none_match,
+    header_if_range,
+    header_if_unmodified_since,
+    header_keep_alive,
+    header_last_modified,
+    header_location,
+    header_origin,
+    header_pragma,
+    header_range,
+    header_referer,
+    header_server,
+    header_set_cookie,
+    header_transfer_encoding,
+    header_upgrade,
+    header_user_agent,
+    header_count
+};
+
+constexpr std::string_view _header_names_[header_count] =
+{
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Accept-Ranges",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Cookie",
+    "Date",
+    "ETag",
+    "Expect",
+    "Host",
+    "If-Match",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "If-Unmodified-Since",
+    "Keep-Alive",
+    "Last-Modified",
+    "Location",
+    "Origin",
+    "Pragma",
+    "Range",
+    "Referer",
+    "Server",
+    "Set-Cookie",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+};
+
+constexpr size_t _header_slot_count_ = 128;
+
+// only the length, the first and the last chars, good enough to separate the names above
+constexpr size_t header_slot(std::string_view name)
+{
+    return name.empty() ? 0 : (name.size() * 23 + (name.front() | 0x20) + (name.back() | 0x20) * 10) % _header_slot_count_;
+}
+
+struct _header_slots
+{
+    int8_t ids[_header_slot_count_] = {};
+    bool perfect = true;
+
+    constexpr _header_slots()
+    {
+        for (size_t i = 0; i < _header_slot_count_; i++)
+            ids[i] = header_unknown;
+        for (int id = 0; id < header_count; id++)
+        {
+            size_t slot = header_slot(_header_names_[id]);
+            if (ids[slot] != header_unknown)
+                perfect = false;
+            ids[slot] = id;
+        }
+    }
+};
+
+constexpr _header_slots _header_slots_;
+static_assert(_header_slots_.perfect, "collision in header_slot(), change the hash or the slot count");
+
+constexpr std::string_view header_name(header_id id)
+{
+    return _header_names_[id];
+}
+
 struct string_case_hash : public std::hash<std::string>
 {
     static inline std::uint32_t get_chars(unsigned char const* p)
@@ -35,7 +155,7 @@ struct string_case_hash : public std::hash<std::string>
     }
 
     // from https://github.com/boostorg/beast/blob/develop/include/boost/beast/http/impl/field.ipp
-    inline size_t operator()(const std::string& s) const
+    inline size_t operator()(std::string_view s) const
     {
         size_t r = 0;
         size_t n = s.size();
@@ -63,7 +183,7 @@ struct string_case_hash : public std::hash<std::string>
 struct string_case_equals : public std::equal_to<std::string>
 {
     // from https://github.com/boostorg/beast/blob/develop/include/boost/beast/http/impl/field.ipp
-    inline bool operator()(const std::string& lhs, const std::string& rhs) const
+    inline bool operator()(std::string_view lhs, std::string_view rhs) const
     {
         auto n = lhs.size();
         if (n != rhs.size())
@@ -91,10 +211,78 @@ static const string_case_equals case_equals;
 
 using string_map = std::unordered_map<std::string, std::string, string_case_hash, string_case_equals>;
 
+inline header_id find_header_id(std::string_view name)
+{
+    int id = _header_slots_.ids[header_slot(name)];
+    return id != header_unknown && case_equals(_header_names_[id], name) ? header_id(id) : header_unknown;
+}
+
 using content_done = std::function<void()>;
-using content_sink = std::function<void(const char* data, size_t size, content_done done)>;
+// false if the bytes queued to write reach the high watermark, to provide no more until the provider is called again.
+// it returned void before, a sink of one's own which ignores the watermarks returns true
+using content_sink = std::function<bool(const char* data, size_t size, content_done done)>;
 using content_provider = std::function<void(int64_t offset, int64_t length, content_sink sink)>;
 
+struct header_field
+{
+    std::string_view name;
+    std::string_view value;
+};
+
+// start line and headers pointing to the received data without copy
+struct message_view
+{
+    std::string_view method;        // of request
+    std::string_view url;           // of request
+    int status_code = 0;            // of response
+    std::string_view status_msg;    // of response
+    int minor_version = 0;
+    std::vector<header_field> headers;
+    uint8_t known[header_count] = {};   // 1-based index in headers of the first well-known header, 0 if absent
+
+    inline void add_header(std::string_view name, std::string_view value)
+    {
+        headers.push_back({ name, value });
+        header_id id = find_header_id(name);
+        if (id != header_unknown && known[id] == 0 && headers.size() <= UINT8_MAX)
+            known[id] = uint8_t(headers.size());
+    }
+
+    inline const header_field* header(header_id id) const
+    {
+        return known[id] != 0 ? &headers[known[id] - 1] : nullptr;
+    }
+
+    inline const header_field* header(std::string_view name) const
+    {
+        header_id id = find_header_id(name);
+        if (id != header_unknown)
+            return header(id);
+
+        for (auto& h : headers)
+        {
+            if (case_equals(h.name, name))
+                return &h;
+        }
+        return nullptr;
+    }
+
+    inline void clear()
+    {
+        method = url = status_msg = std::string_view();
+        status_code = minor_version = 0;
+        headers.clear();
+        std::fill(std::begin(known), std::end(known), 0);
+    }
+};
+
+// a range of the Range header, "first-last", "first-" or the suffix "-last" where first is empty
+struct byte_range
+{
+    std::optional<int64_t> first;
+    std::optional<int64_t> last;
+};
+
 struct request_base
 {
     std::string method = "GET";
@@ -0,0 +1,99 @@
+#ifndef _compressor_h_
+#define _compressor_h_
+
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "common.h"
+
+namespace http
+{
+
+class loop;
+
+// compresses the content of a provider by gzip or deflate with zlib, in the threadpool of loop::queue_work()
+class compressor : public std::enable_shared_from_this<compressor>
+{
+    struct deflater;
+
+public:
+    enum encoding
+    {
+        encoding_none,
+        encoding_gzip,
+        encoding_deflate
+    };
+
+    // nullptr if not built with HAVE_ZLIB, end is -1 if the length of source is unknown
+    static std::shared_ptr<compressor> create(loop* loop, encoding encoding, int level, content_provider source, int64_t end);
+    ~compressor();
+
+    // "gzip" or "deflate" for Content-Encoding
+    static const char* name(encoding encoding);
+
+    // false if not built with HAVE_ZLIB
+    static bool available();
+
+    // one compressed chunk at a time, sink(nullptr, 0, nullptr) after the last one
+    void provide(content_sink sink);
+
+    // called with the whole compressed content if all compressed within max_size, to cache it.
+    // the content is buffered until then, and dropped once over max_size
+    inline void set_on_finished(size_t max_size, std::function<void(std::shared_ptr<std::string> content)>&& on_finished)
+    {
+        on_finished_ = std::move(on_finished);
+        max_content_size_ = max_size;
+    }
+
+private:
+    compressor(loop* loop, content_provider source, int64_t end);
+
+    void read_next();
+    void on_read(const char* data, size_t size, content_done done);
+    void compress(const char* data, size_t size, content_done done, bool finish);
+    void on_compressed(int r, std::shared_ptr<std::string> out);
+
+private:
+    loop* loop_;
+    std::shared_ptr<deflater> deflater_;    // shared with the compressing job
+    content_provider source_;
+    int64_t offset_ = 0;
+    int64_t end_;
+    content_sink sink_;
+    bool busy_ = false;                     // reading or compressing
+    bool finished_ = false;
+    bool ended_ = false;
+    std::function<void(std::shared_ptr<std::string> content)> on_finished_;
+    std::shared_ptr<std::string> content_;  // all compressed so far if on_finished_
+    size_t max_content_size_ = 0;
+};
+
+// compressed contents by path, ETag and encoding, LRU with a byte budget, used in one loop thread
+class compressed_cache
+{
+    using entry = std::pair<std::string, std::shared_ptr<std::string>>;
+
+public:
+    compressed_cache(size_t max_bytes);
+
+    std::shared_ptr<std::string> find(const std::string& key);
+    void insert(const std::string& key, std::shared_ptr<std::string> content);
+
+    // evicts at once if over the new limit
+    void set_limit(size_t max_bytes);
+
+private:
+    void evict();
+
+private:
+    size_t max_bytes_;
+    size_t bytes_ = 0;
+    std::list<entry> entries_; // the most recently used first
+    std::unordered_map<std::string_view, std::list<entry>::iterator> index_;
+};
+
+} // namespace http
+
+#endif // _compressor_h_
\ No newline at end of file
@@ -1,8 +1,11 @@
 #ifndef _content_writer_h_
 #define _content_writer_h_
 
+#include <algorithm>
 #include <list>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace http
 {
@@ -10,47 +13,84 @@ namespace http
 class content_writer
 {
 protected:
-    struct write_req : public uv_write_t
+    // a chunk to write, done_ is called after written or dropped
+    struct write_req
     {
         uv_buf_t buf;
         content_done done_;
+        uv_file file = -1;          // a region of the file to send by sendfile() if not -1, buf.len is its size
+        int64_t file_offset = 0;
+        bool raw = false;           // not content, neither framed nor counted, like the last chunk
 
         write_req(const char* data = nullptr, size_t size = 0, content_done d = nullptr);
         ~write_req();
     };
 
+    // the chunks gathered to a single uv_write()
+    struct write_batch : public uv_write_t
+    {
+        std::vector<std::shared_ptr<write_req>> reqs;
+        std::vector<uv_buf_t> bufs;
+        std::string frames;     // chunk-size lines of the chunked encoding, pointed by bufs
+    };
+
 public:
     content_writer(uv_loop_t* loop);
     virtual ~content_writer();
 
     int start_write(std::shared_ptr<std::string> headers, content_provider provider);
 
+    // done() is called after the headers written,
+    // the content is sent from file by sendfile() if supported, otherwise by provider.
+    // the provider calls sink(nullptr, 0, nullptr) to end the content of unknown length
+    int start_write(const char* headers, size_t size, content_done done, content_provider provider, uv_file file = -1);
+
+    // the provider is called again when the queued bytes drop to low after the sink returned false at high
+    inline void set_watermarks(size_t high, size_t low) { high_watermark_ = high; low_watermark_ = std::min(low, high); }
+
 protected:
     virtual void on_write_end(int error_code) = 0;
+    virtual void on_write_progress() {}
 
+    inline bool is_writing() const { return writing_ != nullptr && !writing_->reqs.empty(); }
     inline bool is_write_done() { return content_written_ >= content_to_write_; }
     inline void set_write_done() { content_to_write_ = 0; }
 
+    size_t queued_size() const;
     void prepare_next();
+    void on_provided_all();
 
-    int write_content(std::shared_ptr<write_req> req);
     int write_next();
+    int write_queued();
+    void on_written(int status);
+
+    int send_next();
+    int send_file();
 
     static void on_written_cb(uv_write_t* req, int status);
+    static void on_writable_cb(uv_poll_t* handle, int status, int events);
 
 protected:
     int64_t content_written_;
     int64_t content_to_write_;
     uv_stream_t* socket_;
     uv_loop_t* loop_;
+    bool chunked_ = false;  // to frame the content by the chunked transfer encoding, set before start_write()
 
 private:
     content_sink content_sink_;
     content_provider content_provider_;
 
-    bool headers_written_ = false;
-    int last_socket_error_ = 0;
-    std::shared_ptr<write_req> writing_req_;
+    size_t queued_ = 0;     // bytes of the content in req_list_
+    size_t high_watermark_ = 1024 * 1024;
+    size_t low_watermark_ = 256 * 1024;
+    bool providing_ = false;
+    int write_error_ = 0;
+    write_batch* writing_ = nullptr;
+    uv_file send_file_ = -1;
+    std::shared_ptr<write_req> sending_req_;
+    uv_poll_t* poll_ = nullptr;     // on a dup of the socket, to wait for writable while sending file
+    std::shared_ptr<write_req> headers_req_;
     std::list<std::shared_ptr<write_req>> req_list_;
 };
 
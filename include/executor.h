@@ -0,0 +1,68 @@
+#ifndef _executor_h_
+#define _executor_h_
+
+#include <stdlib.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace http
+{
+
+class loop;
+
+// a pool of threads of its own for CPU-bound work like route handlers, apart from the threadpool of libuv
+// which file I/O needs. each thread has a deque of jobs, and steals from the others when its own is empty
+class executor
+{
+    struct job
+    {
+        http::loop* loop;
+        std::function<void()> work;
+        std::function<void()> done;
+    };
+
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<job> jobs;
+    };
+
+public:
+    // 0 threads is the count of CPUs
+    executor(size_t thread_count = 0);
+
+    // joins the threads after the posted jobs done
+    ~executor();
+
+    // can be called in any thread, work() runs in a thread of this, then done() in the thread of loop
+    // by loop::async(), which wakes up the loop once for the completions in a row.
+    // loop::prepare_async() should be called before if it runs in other threads
+    bool post(loop* loop, std::function<void()>&& work, std::function<void()>&& done = nullptr);
+
+    inline size_t thread_count() const { return threads_.size(); }
+
+private:
+    bool take(size_t index, job& job);
+    void run(size_t index);
+
+    static void thread_cb(void* arg);
+
+private:
+    std::vector<std::unique_ptr<queue>> queues_;    // one for each thread
+    std::vector<class _executor_thread*> threads_;
+    std::atomic<size_t> next_{0};                   // the queue to post to from other threads
+
+    std::mutex mutex_;                              // for the idle threads to wait for jobs
+    std::condition_variable condition_;
+    size_t pending_ = 0;                            // jobs posted not taken, by mutex_
+    bool stopping_ = false;
+};
+
+} // namespace http
+
+#endif // _executor_h_
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef _file_cache_h_
+#define _file_cache_h_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace http
+{
+
+struct file_cache_stats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// LRU cache of mapped files with a byte budget and an entry limit,
+// pinned entries are never evicted, used in one loop thread, stats() can be read in any thread
+class file_cache
+{
+    struct entry
+    {
+        std::string path;
+        std::shared_ptr<class file_map> fmap;
+        bool pinned;
+    };
+
+public:
+    file_cache(size_t max_bytes, size_t max_entries);
+
+    // moves the entry to the most recently used
+    std::shared_ptr<class file_map> find(const std::string& path);
+
+    // replaces the existing one, files larger than the budget are not cached
+    bool insert(const std::string& path, std::shared_ptr<class file_map> fmap);
+
+    bool erase(const std::string& path);
+
+    // also for the path not cached yet
+    void pin(const std::string& path, bool pinned);
+
+    void clear();
+
+    // evicts at once if over the new limits
+    void set_limits(size_t max_bytes, size_t max_entries);
+
+    file_cache_stats stats() const;
+
+private:
+    void evict();
+
+private:
+    size_t max_bytes_;
+    size_t max_entries_;
+    std::list<entry> entries_; // the most recently used first
+    std::unordered_map<std::string_view, std::list<entry>::iterator> index_;
+    std::unordered_set<std::string> pinned_paths_;
+
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<size_t> entry_count_{0};
+    std::atomic<size_t> bytes_{0};
+};
+
+} // namespace http
+
+#endif // _file_cache_h_
\ No newline at end of file
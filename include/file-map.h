@@ -7,22 +7,32 @@
 namespace http
 {
 
+class loop;
+
 class file_map : public std::enable_shared_from_this<file_map>
 {
 public:
-    file_map(const std::string& path, size_t length = 0, long modified_time = 0);
+    file_map(const std::string& path, size_t length = 0, int64_t modified_time = 0);
+    // maps an opened file, the fd is not closed
+    file_map(int fd, size_t length, int64_t modified_time);
     ~file_map();
 
     inline const char* ptr() const { return ptr_; }
     inline size_t size() const { return size_; }
-    inline long modified_time() const { return modified_time_; }
+    inline int64_t modified_time() const { return modified_time_; }
 
     int read_chunk(int64_t offset, size_t size, content_sink sink);
 
+    // FNV-1a of the mapped content, 0 until it is computed on the threadpool of loop after the first call.
+    // called in the loop thread
+    uint64_t content_hash(loop* loop);
+
 private:
     char* ptr_;
     size_t size_;
-    long modified_time_;
+    int64_t modified_time_; // in nanoseconds if from serve_file()
+    uint64_t content_hash_ = 0;
+    bool hashing_ = false;
 };
 
 } // namespace http
@@ -15,6 +15,8 @@ class file_reader
 
 public:
     file_reader(uv_loop_t* loop, const std::string& path, std::shared_ptr<buffer_pool> buffer_pool);
+    // reads an opened file, the fd is not closed
+    file_reader(uv_loop_t* loop, uv_file fd, std::shared_ptr<buffer_pool> buffer_pool);
     ~file_reader();
 
     inline uv_file get_fd() const { return fd_; }
@@ -30,6 +32,7 @@ protected:
 private:
     uv_loop_t* loop_;
     uv_file fd_;
+    bool own_fd_;
     bool reading_ = false;
     read_req* read_req_;
     content_sink sink_;
@@ -22,6 +22,9 @@ public:
 
     int async(std::function<void()>&& work);
 
+    // create the async handle ahead, call it before run_loop() in other thread
+    int prepare_async();
+
     bool queue_work(std::function<intptr_t()>&& work, std::function<void(intptr_t)>&& done = nullptr);
 
     inline uv_loop_t* get_loop() const { return loop_; }
@@ -33,6 +36,7 @@ public:
     static void on_closed_and_free_cb(uv_handle_t* handle);
 
 protected:
+    int init_async();
     void on_async();
     static void on_async_cb(uv_async_t* handle);
 
@@ -39,9 +39,16 @@ protected:
 
     void reset_status();
 
+    // recycle the buffer which the parsed message_view points to
+    void unpin_buffer();
+
     int on_content_read(const char* data, size_t size);
     int on_socket_read(ssize_t nread, const uv_buf_t* buf);
+    int on_data_read(const char* data, size_t size, const uv_buf_t* buf);
+    int on_pipeline_read();
 
+    virtual void on_message_begin() {}
+    virtual message_view* on_get_view() = 0;
     virtual request_base* on_get_request() = 0;
     virtual response* on_get_response() = 0;
     virtual bool on_headers_parsed(std::optional<int64_t> content_length) = 0;
@@ -51,8 +58,8 @@ protected:
     static void on_alloc_cb(uv_handle_t* handle, size_t size, uv_buf_t* buf);
     static void on_read_cb(uv_stream_t* socket, ssize_t nread, const uv_buf_t* buf);
 
-    static int parse_request(const char* data, size_t size, size_t last_size, request_base& req);
-    static int parse_response(const char* data, size_t size, size_t last_size, response& res);
+    static int parse_request(const char* data, size_t size, size_t last_size, message_view& view);
+    static int parse_response(const char* data, size_t size, size_t last_size, message_view& view);
 
 protected:
     bool request_mode_;
@@ -60,6 +67,11 @@ protected:
     int64_t content_received_ = 0;
     int64_t content_to_receive_ = 0;
     std::string received_cache_;
+    uv_buf_t pinned_buf_ = {};
+    std::string pipeline_;          // received after the current request
+    std::string pipeline_input_;    // the pipelined data being parsed
+    size_t max_pipeline_size_ = 0;  // stop reading while outputing if pipeline_ reaches this
+    bool peer_eof_ = false;
     std::shared_ptr<buffer_pool> buffer_pool_;
     class chunked_decoder* chunked_decoder_ = nullptr;
     std::function<bool(const char* data, size_t size)> chunked_sink_;
@@ -0,0 +1,59 @@
+#ifndef _http_query_string_h_
+#define _http_query_string_h_
+
+#include <stdint.h>
+#include <optional.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http
+{
+
+// fields of "a=1&b=%20" in url queries or application/x-www-form-urlencoded body,
+// split by one pass, the values are decoded only when accessed,
+// buffers are reused by next parse(), so no allocation for the requests of a connection
+class query_string
+{
+    struct field
+    {
+        uint32_t name_pos;
+        uint32_t name_len;
+        uint32_t value_pos;
+        uint32_t value_len;
+    };
+
+public:
+    query_string() = default;
+    explicit query_string(std::string_view s) { parse(s); }
+
+    void parse(std::string_view s);
+    void clear();
+
+    inline bool empty() const { return fields_.empty(); }
+    inline size_t size() const { return fields_.size(); }
+    inline const std::string& text() const { return text_; }
+
+    // still escaped
+    inline std::string_view name(size_t i) const { return view(fields_[i].name_pos, fields_[i].name_len); }
+    inline std::string_view raw_value(size_t i) const { return view(fields_[i].value_pos, fields_[i].value_len); }
+    std::string value(size_t i) const;
+
+    // the first field of name, names are compared after decoded
+    bool has(std::string_view name) const;
+    std::optional<std::string_view> raw_value(std::string_view name) const;
+    std::optional<std::string> value(std::string_view name) const;
+    std::string value_or(std::string_view name, const std::string& default_value) const;
+
+private:
+    size_t find(std::string_view name) const;
+    inline std::string_view view(uint32_t pos, uint32_t len) const { return std::string_view(text_.data() + pos, len); }
+
+private:
+    std::string text_;
+    std::vector<field> fields_;
+};
+
+} // namespace http
+
+#endif // _http_query_string_h_
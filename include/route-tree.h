@@ -0,0 +1,50 @@
+#ifndef _route_tree_h_
+#define _route_tree_h_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace http
+{
+
+using route_params = std::vector<std::pair<std::string_view, std::string_view>>;
+
+// trie of path segments, the cost of finding grows with the segments of path,
+// not with the number of routes
+class route_tree
+{
+    struct node;
+    struct route;
+
+public:
+    route_tree();
+    ~route_tree();
+
+    // segments of pattern: "name" matches literally, ":name" captures a segment,
+    // "*name" captures the rest of path, empty method matches any method.
+    // the names are of each route, "/users/:uid/posts" and "/users/:id" can be both inserted.
+    // return false if the same method and pattern, regardless of the names, is inserted already
+    bool insert(const std::string& method, const std::string& pattern, int id);
+
+    // return id of the route or -1, captures are appended to params,
+    // the names are valid with this tree and the values are valid with path
+    int find(const std::string& method, std::string_view path, route_params& params) const;
+
+    static bool is_pattern_segment(std::string_view segment);
+
+private:
+    static bool insert_route(std::vector<route>& routes, const std::string& method, int id, std::vector<std::string>&& names);
+    static const route* find_method(const std::vector<route>& routes, const std::string& method);
+    static const route* find(const node* n, const std::string& method, std::string_view path, route_params& params);
+
+private:
+    std::unique_ptr<node> root_;
+};
+
+} // namespace http
+
+#endif // _route_tree_h_
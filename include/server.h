@@ -2,11 +2,16 @@
 #define _http_server_h_
 
 #include <stdlib.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <regex>
+#include <vector>
 #include "common.h"
+#include "executor.h"
+#include "file-cache.h"
 #include "loop.h"
+#include "query-string.h"
 
 typedef struct uv_async_s uv_async_t;
 typedef struct uv_loop_s uv_loop_t;
@@ -17,17 +22,64 @@ namespace http
 
 struct request2 : public request_base
 {
-    string_map queries;
-    std::optional<int64_t> range_begin;
-    std::optional<int64_t> range_end;
+    message_view view;  // valid until the router returns
+    string_map params;  // captured by ":name" and "*name" of the route pattern
+    query_string queries;
+    std::vector<byte_range> ranges; // of the Range header, resolved by the content length of the response
 
-    inline bool has_range() const { return range_begin.has_value(); }
+    inline bool has_range() const { return !ranges.empty(); }
+
+    // to stop reading the body from the socket, e.g. in router::on_data while the last data is being stored,
+    // the peer is held back by TCP until resume(). called in the loop thread of the request, paired,
+    // on_data may still get the rest of the data already read. body_timeout still applies, which closes the
+    // connection, then resume() does nothing but release it
+    void pause() const;
+    void resume() const;
+
+private:
+    friend class _responser;
+    class _responser* responser_ = nullptr;
 };
 
 struct response2 : public response
 {
+    // without content_length, it calls sink(nullptr, 0, nullptr) to end the content,
+    // sent in the chunked encoding to HTTP/1.1 clients, or closing the connection for HTTP/1.0
     content_provider provider;
     content_done releaser;
+    int sendfile_fd = -1;   // to send the content by sendfile() where supported, provider is the fallback
+
+    // called by the router to complete the response later by the returned handle, nullptr if already deferred.
+    // the connection waits without blocking the loop, answered 504 and closed if not completed within write_timeout,
+    // then completing the handle does nothing
+    std::shared_ptr<class deferred_response> defer();
+
+private:
+    friend class server;
+    friend class _responser;
+    class _responser* responser_ = nullptr; // to defer the response while serve_file() opens the file
+};
+
+// completes a deferred response in the loop thread of the request, after a backend or the threadpool done
+class deferred_response
+{
+public:
+    // completed by status 500 if not yet
+    ~deferred_response();
+
+    // can be called in any thread, only the first call counts.
+    // fill() sets the response in the loop thread, skipped if the connection is closed before,
+    // request2::view is not valid then but the other fields are
+    void complete(std::function<void(response2& res)>&& fill);
+
+private:
+    friend class _responser;
+    deferred_response(class loop* loop, class _responser* responser);
+
+private:
+    loop* loop_;
+    class _responser* responser_;
+    std::atomic<bool> completed_{false};
 };
 
 using on_request_start = std::function<bool(const request2& req)>;
@@ -39,6 +91,91 @@ struct router
     on_request_start on_start;
     on_request_data on_data;
     on_router on_route;
+    bool copy_headers = true;   // false to read request_.view only, without copying headers into request2::headers
+    std::vector<std::string> captured_headers;  // if not empty, copy only these headers into request2::headers
+
+    // to run on_route in the threads of this, not blocking the loop by CPU-bound work,
+    // request2::view is not valid there, nor serve_file() and response2::defer() can be called
+    std::shared_ptr<http::executor> executor;
+};
+
+struct server_options
+{
+    enum dispatch_mode
+    {
+        dispatch_reuse_port,        // every worker accepts on its own SO_REUSEPORT socket
+        dispatch_round_robin,       // the first worker accepts and hands sockets to workers in turn
+        dispatch_least_connections  // the first worker accepts and hands sockets to the least loaded worker
+    };
+
+    // number of loops to serve, every loop runs in its own thread (except the first one,
+    // which runs in run_loop()) and owns its buffer pool and file cache
+    int worker_count = 1;
+
+    enum overload_mode
+    {
+        overload_pause,             // stop accepting until a connection is closed
+        overload_reject             // accept and reply 503 then close
+    };
+
+    // how the accepted sockets are spread to the workers
+    dispatch_mode dispatch = dispatch_reuse_port;
+
+    // backlog of the listen sockets
+    int backlog = 128;
+
+    // max live connections of each worker, 0 is unlimited
+    int max_connections = 0;
+
+    // what to do with new connections after max_connections reached
+    overload_mode overload = overload_pause;
+
+    // memory budget and entry limit of the mapped file cache of each worker
+    size_t file_cache_size = 256 * 1024 * 1024;
+    size_t file_cache_entries = 1024;
+
+    // milliseconds to reuse the stat result and the opened fd of a served file, 0 to open it every time
+    uint32_t file_info_ttl = 1000;
+
+    // watch the directories of the served files (inotify on Linux) to drop the cached ones when changed,
+    // the watched files are reused without file_info_ttl
+    bool watch_files = false;
+
+    // serve_file() looks for precompressed "name.br" and "name.gz" beside the file, to send the one
+    // accepted by the client with Content-Encoding
+    bool precompressed = false;
+
+    // compress the responses of compressible Content-Type by gzip or deflate if accepted,
+    // in the threadpool by zlib (only if built with HAVE_ZLIB), sent in the chunked encoding
+    bool compression = false;
+    int compression_level = 6;
+    int64_t compression_min_size = 1024;            // smaller ones of known length are sent as they are
+    size_t compression_cache_size = 32 * 1024 * 1024; // of each worker, for the compressed responses with ETag
+
+    // ETag of serve_file() from a hash of the content instead of the inode, size and mtime,
+    // hashed once on the threadpool when the file is mapped, the latter is used until then and for files not mapped
+    bool etag_content_hash = false;
+
+    // serve_file() sends the files of at least this size by sendfile() on Linux, -1 is disabled
+    int64_t sendfile_min_size = -1;
+
+    // bytes of pipelined requests to buffer while responding, reading pauses above it
+    size_t max_pipeline_size = 64 * 1024;
+
+    // bytes of a response queued to write, the content sink returns false at high,
+    // and the provider is called again when drained to low
+    size_t write_high_watermark = 1024 * 1024;
+    size_t write_low_watermark = 256 * 1024;
+
+    // timeouts in milliseconds to close the connection, 0 is disabled
+    uint32_t header_timeout = 30 * 1000;        // to receive the headers of a request
+    uint32_t body_timeout = 30 * 1000;          // between two reads of a request body
+    uint32_t keep_alive_timeout = 15 * 1000;    // idle before the next request of a connection
+    uint32_t write_timeout = 60 * 1000;         // between two writes of a response
+
+    // a persistent connection is closed after the response to its last request, 0 is unlimited
+    uint32_t keep_alive_max_requests = 1000;    // requests of a connection
+    uint32_t keep_alive_max_age = 3600 * 1000;  // milliseconds since the connection accepted
 };
 
 class server : public loop
@@ -51,9 +188,20 @@ public:
     server(bool use_default = true);
     ~server();
 
+    // change it before listen()
+    inline server_options& options() { return options_; }
+
+    // segments of pattern: "name" matches literally, ":name" captures a segment to request2::params,
+    // "*name" captures the rest of path. patterns with regex characters, or ".*", are matched by std::regex after
+    // others, a '.' alone is literal.
+    // should be called before listen()
     void serve(const std::string& pattern, on_router&& on_route);
     void serve(const std::string& pattern, router router);
+    void serve(const std::string& method, const std::string& pattern, on_router&& on_route);
+    void serve(const std::string& method, const std::string& pattern, router router);
 
+    // should be called in the loop thread which is serving the request.
+    // if the file is not known yet, the response is deferred until it is opened on the threadpool, and true is returned
     bool serve_file(const std::string& path, const request2& req, response2& res);
 
     bool listen(const std::string& address, int port, int socket_type = 0);
@@ -63,17 +211,37 @@ public:
     bool remove_cache(const std::string& path);
     void remove_cache(const std::vector<std::string>& paths);
 
+    // pinned files are kept in the cache of every worker regardless of the limits
+    void pin_cache(const std::string& path, bool pinned = true);
+
+    // summed over the workers
+    file_cache_stats cache_stats() const;
+
 private:
-    void on_connection(uv_stream_t* socket);
-    static void on_connection_cb(uv_stream_t* socket, int status);
+    friend class _responser;
+    friend class _worker;
+
+    class _worker* local_worker() const;
+    class _worker* dispatch_worker();
+    void for_each_worker(std::function<void(class _worker*)>&& func);
+    bool serve_file(class _worker* worker, const std::shared_ptr<struct _file_info>& info, const struct _file_conditions& conditions, response2& res);
 
 private:
     int port_;
-    uv_stream_t* socket_;
-    std::shared_ptr<class buffer_pool> buffer_pool_;
-    std::unordered_map<std::string, std::shared_ptr<class file_map>> file_cache_;
-    std::unordered_map<std::string, router> router_map_;
-    std::list<std::pair<std::regex, router>> router_list_;
+    server_options options_;
+    std::vector<class _worker*> workers_;
+    size_t next_worker_ = 0;
+    struct regex_route
+    {
+        std::string method;
+        std::string pattern;
+        std::regex regex;
+        int id;
+    };
+
+    std::vector<router> routers_;
+    std::shared_ptr<class route_tree> route_tree_;
+    std::vector<regex_route> regex_routes_;
 };
 
 } // namespace http
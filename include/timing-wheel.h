@@ -0,0 +1,70 @@
+#ifndef _timing_wheel_h_
+#define _timing_wheel_h_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
+
+typedef struct uv_loop_s uv_loop_t;
+typedef struct uv_timer_s uv_timer_t;
+
+namespace http
+{
+
+// hashed timing wheel, all the timeouts of a loop share one uv_timer_t,
+// schedule and cancel are O(1), every tick only visits the entries of one slot
+class timing_wheel
+{
+    struct link
+    {
+        link* prev = this;
+        link* next = this;
+    };
+
+public:
+    class entry : private link
+    {
+        friend class timing_wheel;
+
+    public:
+        virtual ~entry();
+
+        inline bool is_scheduled() const { return wheel_ != nullptr; }
+
+    protected:
+        virtual void on_timeout() = 0;
+
+    private:
+        timing_wheel* wheel_ = nullptr;
+        uint64_t expire_tick_ = 0;
+    };
+
+public:
+    timing_wheel(uv_loop_t* loop, uint64_t tick = 500, size_t slot_count = 256);
+    ~timing_wheel();
+
+    // reschedule if it is scheduled, timeout in milliseconds
+    void schedule(entry* e, uint64_t timeout);
+    void cancel(entry* e);
+
+private:
+    void on_tick();
+    static void on_tick_cb(uv_timer_t* handle);
+
+    static void unlink(link* l);
+    static void link_tail(link* head, link* l);
+
+private:
+    uv_loop_t* loop_;
+    uv_timer_t* timer_;
+    uint64_t tick_;
+    uint64_t start_time_ = 0;
+    uint64_t current_tick_ = 0;
+    size_t slot_count_;
+    size_t entry_count_ = 0;
+    std::unique_ptr<link[]> slots_;
+};
+
+} // namespace http
+
+#endif // _timing_wheel_h_
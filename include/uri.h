@@ -2,6 +2,7 @@
 #define _http_uri_h_
 
 #include <string>
+#include <string_view>
 
 namespace http
 {
@@ -15,7 +16,7 @@ struct uri
 
     bool parse(const std::string& url);
 
-    static std::string decode(const std::string& s);
+    static std::string decode(std::string_view s);
     static std::string encode(const std::string& s);
 };
 
@@ -1,8 +1,13 @@
 #ifndef _http_utils_h_
 #define _http_utils_h_
 
+#include <time.h>
 #include <optional.hpp>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "common.h"
 
 namespace http
 {
@@ -11,12 +16,29 @@ int decode_hex(int ch);
 
 std::string file_extension(const std::string& path);
 
-bool from_hex_to_i(const std::string& s, size_t i, size_t cnt, int& val);
+bool from_hex_to_i(std::string_view s, size_t i, size_t cnt, int& val);
 
-bool parse_range(const std::string& s, std::optional<int64_t>& begin, std::optional<int64_t>& end);
+// "bytes=0-99, 200-, -50", false and none parsed if the syntax is invalid
+bool parse_ranges(std::string_view s, std::vector<byte_range>& ranges);
+
+// the satisfiable ranges of the content of length to [first, last], sorted, the overlapping and adjacent ones coalesced
+void resolve_ranges(const std::vector<byte_range>& ranges, int64_t length, std::vector<std::pair<int64_t, int64_t>>& resolved);
 
 size_t to_utf8(int code, char* buf);
 
+// IMF-fixdate of RFC 7231, like "Sun, 06 Nov 1994 08:49:37 GMT", buf needs 30 chars with the ending zero
+size_t format_http_date(time_t time, char* buf);
+
+// by the value of Accept-Encoding, "coding;q=0" is not acceptable, "*" matches any
+bool accepts_encoding(std::string_view accept_encoding, std::string_view coding);
+
+// only IMF-fixdate, the obsolete formats are treated as invalid
+bool parse_http_date(std::string_view s, time_t& time);
+
+// by the options of the Connection header (empty if none), persistent by default since HTTP/1.1 as RFC 7230,
+// only by "keep-alive" for HTTP/1.0, "close" wins
+bool is_persistent(int minor_version, std::string_view connection);
+
 } // namespace http
 
 #endif // _http_utils_h_
\ No newline at end of file
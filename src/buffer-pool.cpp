@@ -38,7 +38,7 @@ void* buffer_pool::get_buffer(size_t size)
 {
 #ifdef _ENABLE_CACHE_
     buffer* p_buf;
-    if (header_ != nullptr)
+    if (header_ != nullptr && header_->size >= size)
     {
         p_buf = header_;
         header_ = header_->next;
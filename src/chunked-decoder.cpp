@@ -50,8 +50,9 @@ int chunked_decoder::decode(const char* data, size_t size, std::function<bool(co
             ++src;
             if (bytes_in_chunk_ == 0)
             {
-                sink(data + src, 0); // done
-                goto Complete;
+                // the last chunk, skip the trailers
+                state_ = STATE_TRAILERS_LINE_HEAD;
+                break;
             }
             state_ = STATE_CHUNK_DATA;
         /* fallthru */
@@ -118,6 +119,7 @@ int chunked_decoder::decode(const char* data, size_t size, std::function<bool(co
     }
 
 Complete:
+    sink(data + src, 0); // done
     ret = (int)(size - src);
 Exit:
     return ret;
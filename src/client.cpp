@@ -63,6 +63,7 @@ public:
         socket_ = nullptr;
         if (socket != nullptr)
         {
+            uv_read_stop(socket);
             uv_handle_set_data((uv_handle_t*)socket, nullptr);
             socket_cache_->erase(key_);
         }
@@ -112,6 +113,7 @@ protected:
 
     // for response
     response response_;
+    message_view view_;
 
     // for callbacks
     on_response on_response_;
@@ -152,14 +154,15 @@ protected:
             uv_handle_set_data((uv_handle_t*)socket, nullptr);
             if (keep_alive && last_error_ == 0)
             {
+                // still reading after the response, restarted by the checker
+                uv_read_stop(socket);
                 std::string key = uri_.host + ':' + uri_.port;
                 auto checker = new _socket_checker(socket, key, socket_cache_);
                 if (checker->start() == 0)
-                {
                     socket_cache_->emplace(key, checker);
-                    return;
-                }
-                checker->release();
+                else
+                    checker->release(); // closes the socket
+                return;
             }
             uv_close((uv_handle_t*)socket, on_closed_and_free_cb);
             // trace("%p:%p socket closed\n", this, socket);
@@ -206,7 +209,6 @@ protected:
 
         auto pstr = std::make_shared<std::string>();
         std::string& str = *pstr.get();
-        str.reserve(buffer_pool::buffer_size);
 
         str.append(request_.method);
         str.append(" ");
@@ -233,6 +235,11 @@ protected:
         return content_writer::start_write(pstr, request_.provider);
     }
 
+    virtual message_view* on_get_view()
+    {
+        return &view_;
+    }
+
     virtual request_base* on_get_request()
     {
         assert(!"should not be called!");
@@ -275,7 +282,7 @@ protected:
         }
 
         p = response_.headers.find(HEADER_CONNECTION);
-        keep_alive_ = p != end && case_equals(p->second, "Keep-Alive");
+        keep_alive_ = is_persistent(view_.minor_version, p != end ? std::string_view(p->second) : std::string_view());
 
         response_.content_length = content_length;
         return on_response_ ? on_response_(response_) : true;
@@ -380,9 +387,11 @@ client::client(bool use_default) : loop(use_default)
 
 client::~client()
 {
-    for (auto& p : (*socket_cache_))
-        p.second->release();
+    // a released checker erases itself from the cache
+    auto checkers = std::move(*socket_cache_);
     socket_cache_->clear();
+    for (auto& p : checkers)
+        p.second->release();
 }
 
 int client::fetch(const request& request,
@@ -464,7 +473,7 @@ int client::fetch(const request& request,
             return true;
         },
         std::move(on_redirect),
-        std::move(on_end)
+        on_end // copied, the content callback above holds another one
     );
 }
 
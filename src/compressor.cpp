@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <uv.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#include "compressor.h"
+#include "loop.h"
+#include "trace.h"
+
+namespace http
+{
+
+#ifdef HAVE_ZLIB
+struct compressor::deflater
+{
+    z_stream stream = {};
+    bool ready = false;
+
+    ~deflater()
+    {
+        if (ready)
+            deflateEnd(&stream);
+    }
+
+    // appends to out, runs in the threadpool
+    int deflate(const char* data, size_t size, bool finish, std::string& out)
+    {
+        static const size_t min_out_size = 16 * 1024;
+
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = (uInt)size;
+        do
+        {
+            size_t used = out.size();
+            out.resize(used + std::max(size / 2, min_out_size));
+            stream.next_out = (Bytef*)&out[used];
+            stream.avail_out = (uInt)(out.size() - used);
+            int r = ::deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+            out.resize(out.size() - stream.avail_out);
+            if (r == Z_STREAM_ERROR)
+                return UV_EINVAL;
+        } while (stream.avail_out == 0);
+        return 0;
+    }
+};
+#else
+struct compressor::deflater
+{
+};
+#endif
+
+compressor::compressor(loop* loop, content_provider source, int64_t end)
+{
+    loop_ = loop;
+    source_ = std::move(source);
+    end_ = end;
+}
+
+compressor::~compressor()
+{
+}
+
+std::shared_ptr<compressor> compressor::create(loop* loop, encoding encoding, int level, content_provider source, int64_t end)
+{
+#ifdef HAVE_ZLIB
+    auto d = std::make_shared<deflater>();
+    // 16 more window bits for the gzip header and trailer, deflate of HTTP is the zlib format
+    int window_bits = encoding == encoding_gzip ? 15 + 16 : 15;
+    if (encoding == encoding_none || deflateInit2(&d->stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return nullptr;
+    d->ready = true;
+
+    std::shared_ptr<compressor> c(new compressor(loop, std::move(source), end));
+    c->deflater_ = d;
+    return c;
+#else
+    return nullptr;
+#endif
+}
+
+bool compressor::available()
+{
+#ifdef HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* compressor::name(encoding encoding)
+{
+    switch (encoding)
+    {
+    case encoding_gzip:
+        return "gzip";
+    case encoding_deflate:
+        return "deflate";
+    default:
+        return "identity";
+    }
+}
+
+void compressor::provide(content_sink sink)
+{
+    sink_ = std::move(sink);
+    if (busy_)
+        return; // sinks after the reading or compressing one done
+
+    if (finished_)
+    {
+        if (!ended_)
+        {
+            ended_ = true;
+            sink_(nullptr, 0, nullptr);
+        }
+        return;
+    }
+    read_next();
+}
+
+void compressor::read_next()
+{
+    busy_ = true;
+    if (end_ >= 0 && offset_ >= end_)
+    {
+        compress(nullptr, 0, nullptr, true);
+        return;
+    }
+
+    // the source may call back after this is gone, e.g. on its own timer,
+    // and is called again for the next chunk after this one compressed
+    std::weak_ptr<compressor> weak = shared_from_this();
+    source_(offset_, end_ >= 0 ? end_ : INT64_MAX, [weak](const char* data, size_t size, content_done done) {
+        auto p_this = weak.lock();
+        if (p_this != nullptr)
+            p_this->on_read(data, size, done);
+        else if (done)
+            done();
+        return false;
+    });
+}
+
+void compressor::on_read(const char* data, size_t size, content_done done)
+{
+    int r = (int)size;
+    if (r < 0)
+    {
+        busy_ = false;
+        sink_(nullptr, r, nullptr);
+        return;
+    }
+
+    // an empty chunk is the end of the source
+    offset_ += size;
+    bool finish = size == 0 || (end_ >= 0 && offset_ >= end_);
+    compress(data, size, done, finish);
+}
+
+void compressor::compress(const char* data, size_t size, content_done done, bool finish)
+{
+    auto d = deflater_;
+    auto out = std::make_shared<std::string>();
+    std::weak_ptr<compressor> weak = shared_from_this();
+    bool queued = loop_->queue_work([d, data, size, finish, out]() -> intptr_t {
+#ifdef HAVE_ZLIB
+        return d->deflate(data, size, finish, *out);
+#else
+        return UV_ENOSYS;
+#endif
+    }, [weak, done, finish, out](intptr_t r) {
+        // the source chunk is compressed
+        if (done)
+            done();
+        auto p_this = weak.lock();
+        if (p_this == nullptr)
+            return;
+        if (finish && r >= 0)
+            p_this->finished_ = true;
+        p_this->on_compressed((int)r, out);
+    });
+
+    if (!queued)
+    {
+        if (done)
+            done();
+        on_compressed(UV_ENOMEM, out);
+    }
+}
+
+void compressor::on_compressed(int r, std::shared_ptr<std::string> out)
+{
+    busy_ = false;
+    if (r < 0)
+    {
+        trace("compress: %s\n", uv_err_name(r));
+        sink_(nullptr, r, nullptr);
+        return;
+    }
+
+    if (on_finished_)
+    {
+        if (!content_)
+            content_ = std::make_shared<std::string>();
+        if (content_->size() + out->size() > max_content_size_)
+        {
+            // too large to cache, not to keep a second copy of the whole output
+            content_.reset();
+            on_finished_ = nullptr;
+        }
+        else
+        {
+            content_->append(*out);
+            if (finished_)
+                on_finished_(content_);
+        }
+    }
+
+    // zlib keeps the small input until the window fills
+    if (out->empty() && !finished_)
+    {
+        read_next();
+        return;
+    }
+
+    content_sink sink = sink_;
+    if (!out->empty())
+        sink(out->data(), out->size(), [out]() {});
+    if (finished_ && !ended_)
+    {
+        ended_ = true;
+        sink(nullptr, 0, nullptr);
+    }
+}
+
+compressed_cache::compressed_cache(size_t max_bytes)
+{
+    max_bytes_ = max_bytes;
+}
+
+std::shared_ptr<std::string> compressed_cache::find(const std::string& key)
+{
+    auto p = index_.find(key);
+    if (p == index_.cend())
+        return nullptr;
+
+    entries_.splice(entries_.begin(), entries_, p->second);
+    return p->second->second;
+}
+
+void compressed_cache::insert(const std::string& key, std::shared_ptr<std::string> content)
+{
+    if (content->size() > max_bytes_ || index_.count(key))
+        return;
+
+    entries_.emplace_front(key, content);
+    index_[entries_.front().first] = entries_.begin();
+    bytes_ += content->size();
+    evict();
+}
+
+void compressed_cache::set_limit(size_t max_bytes)
+{
+    max_bytes_ = max_bytes;
+    evict();
+}
+
+void compressed_cache::evict()
+{
+    while (bytes_ > max_bytes_ && !entries_.empty())
+    {
+        auto& e = entries_.back();
+        bytes_ -= e.second->size();
+        index_.erase(e.first);
+        entries_.pop_back();
+    }
+}
+
+} // namespace http
\ No newline at end of file
@@ -2,7 +2,12 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <memory.h>
+#include <algorithm>
 #include <uv.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
 #include "buffer-pool.h"
 #include "common.h"
 #include "content-writer.h"
@@ -34,44 +39,73 @@ content_writer::content_writer(uv_loop_t* loop)
 
     content_sink_ = [this](const char* data, size_t size, content_done done)
     {
+        if (data == nullptr && size == 0)
+        {
+            on_provided_all();
+            return false;
+        }
+
         auto req = std::make_shared<write_req>(data, size, done);
-        if (!headers_written_ || writing_req_ || last_socket_error_ < 0)
+        int r = (int)req->buf.len;
+        if (r < 0)
         {
-            // push to list tail, will be written in on_written_cb()
-            req_list_.push_back(req);
-            return;
+            // to stop write, after the writing one done
+            trace("%p:%p stop: %s\n", this, socket_, uv_err_name(r));
+            if (write_error_ == 0)
+                write_error_ = r;
+            if (!providing_ && !is_writing())
+                on_write_end(r);
+            return false;
         }
 
-        if (!req_list_.empty())
+        // push to list tail, will be gathered after the provider returns or the writing one done
+        if (r > 0)
         {
-            // push to list tail, pop the front
+            queued_ += req->buf.len;
             req_list_.push_back(req);
-            req = req_list_.front();
-            req_list_.pop_front();
         }
+        if (providing_ || is_writing())
+            return queued_size() < high_watermark_;
 
-        int r = (int)req->buf.len;
-        if (r > 0)
-            r = write_content(req);
+        r = write_queued();
         if (r < 0)
         {
-            // to stop write
-            trace("%p:%p stop: %s\n", this, socket_, uv_err_name(r));
-            if (writing_req_)
-                on_written_cb(writing_req_.get(), r);
-            else
-                on_write_end(r);
+            on_write_end(r);
+            return false;
         }
+        return queued_size() < high_watermark_;
     };
 }
 
 content_writer::~content_writer()
 {
-    assert(!writing_req_);
-    if (writing_req_)
-        uv_req_set_data((uv_req_t*)writing_req_.get(), nullptr);
+    assert(!is_writing());
+    if (writing_ != nullptr)
+    {
+        // on_written_cb() will free it if still writing
+        uv_req_set_data((uv_req_t*)writing_, nullptr);
+        if (!is_writing())
+            delete writing_;
+    }
+
+    if (poll_ != nullptr)
+    {
+        // close the dup of the socket after the handle closed
+        uv_os_fd_t fd = -1;
+        uv_fileno((uv_handle_t*)poll_, &fd);
+        uv_handle_set_data((uv_handle_t*)poll_, (void*)(intptr_t)fd);
+        uv_close((uv_handle_t*)poll_, [](uv_handle_t* handle) {
+#ifdef __linux__
+            close((int)(intptr_t)uv_handle_get_data(handle));
+#endif
+            free(handle);
+        });
+    }
 
+    sending_req_.reset();
+    headers_req_.reset();
     req_list_.clear();
+    queued_ = 0;
 
     uv_stream_t* tcp = socket_;
     socket_ = nullptr;
@@ -84,117 +118,318 @@ content_writer::~content_writer()
 
 int content_writer::start_write(std::shared_ptr<std::string> headers, content_provider provider)
 {
-    assert(!writing_req_);
+    return start_write(headers->c_str(), headers->size(), [headers]() {}, provider);
+}
+
+int content_writer::start_write(const char* headers, size_t size, content_done done, content_provider provider, uv_file file)
+{
+    assert(!is_writing());
     assert(req_list_.empty());
     req_list_.clear();
 
     content_provider_ = provider;
-    headers_written_ = false;
+#ifdef __linux__
+    send_file_ = content_to_write_ < INT64_MAX ? file : -1;
+#endif
+    write_error_ = 0;
+    headers_req_ = std::make_shared<write_req>(headers, size, done);
 
-    if (provider && content_to_write_ <= buffer_pool::buffer_size)
-    {
-        // preload small content and combine to single buffer
-        provider(content_written_, content_to_write_, content_sink_);
-        for (const auto& req : req_list_)
-        {
-            headers->append(req->buf.base, req->buf.len);
-            content_written_ += req->buf.len;
-        }
-        req_list_.clear();
-    }
-
-    writing_req_ = std::make_shared<write_req>(headers->c_str(), headers->size(), [headers]() {});
-    uv_req_set_data((uv_req_t*)writing_req_.get(), this);
+    // the chunks provided at once are written with the headers
+    prepare_next();
 
-    int r = uv_write(writing_req_.get(), socket_, &writing_req_->buf, 1, on_written_cb);
+    int r = write_queued();
     if (r < 0)
     {
-        writing_req_.reset();
-        return r;
+        headers_req_.reset();
+        req_list_.clear();
+        queued_ = 0;
     }
+    return r;
+}
 
-    headers_written_ = true;
-    prepare_next();
-    return 0;
+size_t content_writer::queued_size() const
+{
+    // the batch being written is in the write queue of the socket
+    return queued_ + (socket_ != nullptr ? uv_stream_get_write_queue_size(socket_) : 0);
 }
 
 void content_writer::prepare_next()
 {
-    if (content_provider_ && !is_write_done())
-        content_provider_(content_written_, content_to_write_, content_sink_);
-    else
+    // from the end of the queued content
+    int64_t offset = content_written_ + (int64_t)queued_;
+    if (send_file_ >= 0 && !is_write_done())
+    {
+        // the rest of the file, sent after the queued buffers written
+        auto req = std::make_shared<write_req>(nullptr, (size_t)(content_to_write_ - content_written_), nullptr);
+        req->file = send_file_;
+        req->file_offset = content_written_;
+        req_list_.push_back(req);
+    }
+    else if (content_provider_ && offset < content_to_write_)
+    {
+        providing_ = true;
+        content_provider_(offset, content_to_write_, content_sink_);
+        providing_ = false;
+    }
+    else if (req_list_.empty())
         set_write_done();
 }
 
-int content_writer::write_content(std::shared_ptr<write_req> req)
+void content_writer::on_provided_all()
 {
-    int64_t max_write = content_to_write_ - content_written_;
-    if (req->buf.len > max_write)
-        req->buf.len = static_cast<decltype(req->buf.len)>(max_write);
-    content_written_ += req->buf.len;
+    int64_t end = content_written_ + (int64_t)queued_;
 
-    assert(!writing_req_);
-    writing_req_ = req;
-    uv_req_set_data((uv_req_t*)writing_req_.get(), this);
+    if (content_to_write_ == INT64_MAX)
+    {
+        content_to_write_ = end;
+        if (chunked_)
+        {
+            static const char last_chunk[] = "0\r\n\r\n";
+            auto req = std::make_shared<write_req>(last_chunk, sizeof(last_chunk) - 1, nullptr);
+            req->raw = true;
+            req_list_.push_back(req);
+        }
+    }
+    else if (end < content_to_write_ && write_error_ == 0)
+        write_error_ = UV_EOF; // less than the Content-Length
 
-    int r = uv_write(writing_req_.get(), socket_, &writing_req_->buf, 1, on_written_cb);
+    if (providing_ || is_writing())
+        return;
+    int r = write_queued();
     if (r < 0)
-        writing_req_.reset();
-    return r;
+        on_write_end(r);
+    else if (!is_writing() && req_list_.empty())
+    {
+        // all written before the end, no on_written() to end it
+        content_provider_ = nullptr;
+        on_write_end(0);
+    }
 }
 
 int content_writer::write_next()
 {
-    if (is_write_done())
-        return 0;
+    static const size_t max_bufs = 64;
+    static const size_t max_size = 1024 * 1024;
+
+    assert(!is_writing());
+    if (!headers_req_ && !req_list_.empty() && req_list_.front()->file >= 0)
+        return send_next();
+
+    if (writing_ == nullptr)
+        writing_ = new write_batch;
+
+    auto& reqs = writing_->reqs;
+    auto& bufs = writing_->bufs;
+    auto& frames = writing_->frames;
+    size_t size = 0;
 
-    if (req_list_.empty())
+    // not to reallocate while bufs point to it
+    frames.clear();
+    frames.reserve(max_bufs * 8);
+    if (headers_req_)
     {
-        prepare_next();
+        size += headers_req_->buf.len;
+        bufs.push_back(headers_req_->buf);
+        reqs.push_back(std::move(headers_req_));
+    }
+
+    while (!req_list_.empty() && req_list_.front()->file < 0 && bufs.size() + 3 <= max_bufs && size < max_size)
+    {
+        auto req = req_list_.front();
+        req_list_.pop_front();
+        if (!req->raw)
+            queued_ -= req->buf.len;
+
+        if (req->raw)
+        {
+            size += req->buf.len;
+            bufs.push_back(req->buf);
+            reqs.push_back(std::move(req));
+            continue;
+        }
+
+        int64_t max_write = content_to_write_ - content_written_;
+        if (req->buf.len > max_write)
+            req->buf.len = static_cast<decltype(req->buf.len)>(max_write);
+        if (req->buf.len == 0)
+            continue;
+
+        content_written_ += req->buf.len;
+        size += req->buf.len;
+        if (!chunked_)
+            bufs.push_back(req->buf);
+        else
+        {
+            // "size\r\n", data, "\r\n"
+            char head[20];
+            int n = snprintf(head, sizeof(head), "%zx\r\n", (size_t)req->buf.len);
+            size_t pos = frames.size();
+            frames.append(head, n);
+            bufs.push_back(uv_buf_init(&frames[pos], n));
+            bufs.push_back(req->buf);
+            bufs.push_back(uv_buf_init((char*)"\r\n", 2));
+        }
+        reqs.push_back(std::move(req));
+    }
+
+    if (bufs.empty())
         return 0;
+
+    uv_req_set_data((uv_req_t*)writing_, this);
+    int r = uv_write(writing_, socket_, bufs.data(), (unsigned int)bufs.size(), on_written_cb);
+    if (r < 0)
+    {
+        reqs.clear();
+        bufs.clear();
     }
+    return r;
+}
 
-    auto req = req_list_.front();
-    req_list_.pop_front();
+int content_writer::write_queued()
+{
+    if (req_list_.empty() && !headers_req_)
+        prepare_next();
+    if (write_error_ < 0)
+        return write_error_;
 
-    int r = (int)req->buf.len;
-    if (r >= 0)
-        r = write_content(req);
+    int r = write_next();
 
-    if (r >= 0 && req_list_.empty())
+    // to provide the next chunks while writing, until the queued ones reach the high watermark
+    if (r >= 0 && is_writing() && (req_list_.empty() || (send_file_ < 0 && queued_size() <= low_watermark_)))
         prepare_next();
     return r;
 }
 
-void content_writer::on_written_cb(uv_write_t* req, int status)
+void content_writer::on_written(int status)
 {
-    content_writer* p_this = (content_writer*)uv_req_get_data((uv_req_t*)req);
-    if (p_this == nullptr)
-        return;
+    if (status >= 0 && write_error_ < 0)
+        status = write_error_;
+
+    if (status >= 0 && !(is_write_done() && req_list_.empty()))
+    {
+        on_write_progress();
+        status = write_queued();
+        if (status >= 0)
+            return;
+        trace("%p:%p write_socket: %s\n", this, socket_, uv_err_name(status));
+    }
+    else if (status < 0)
+        trace("%p:%p on_written: %s\n", this, socket_, uv_err_name(status));
 
-    p_this->last_socket_error_ = status;
-    p_this->writing_req_.reset();
+    content_provider_ = nullptr;
+    on_write_end(status);
+}
 
-    if (p_this->is_write_done())
+int content_writer::send_next()
+{
+    sending_req_ = req_list_.front();
+    req_list_.pop_front();
+
+    int64_t max_write = content_to_write_ - content_written_;
+    if (sending_req_->buf.len > max_write)
+        sending_req_->buf.len = static_cast<decltype(sending_req_->buf.len)>(max_write);
+    content_written_ += sending_req_->buf.len;
+
+    // send in on_writable_cb(), a dup of the socket is polled as libuv polls the socket itself
+    int r = 0;
+#ifdef __linux__
+    if (poll_ == nullptr)
     {
-        p_this->content_provider_ = nullptr;
-        p_this->on_write_end(status);
-        return;
+        uv_os_fd_t fd;
+        r = uv_fileno((uv_handle_t*)socket_, &fd);
+        if (r == 0)
+        {
+            poll_ = (uv_poll_t*)calloc(sizeof(uv_poll_t), 1);
+            fd = dup(fd);
+            r = fd < 0 ? UV_EMFILE : uv_poll_init(loop_, poll_, fd);
+            if (r < 0)
+            {
+                if (fd >= 0)
+                    close(fd);
+                free(poll_);
+                poll_ = nullptr;
+            }
+        }
     }
+#else
+    r = UV_ENOSYS;
+#endif
 
-    if (status >= 0)
+    if (r == 0)
     {
-        status = p_this->write_next();
-        if (status < 0)
-            trace("%p:%p write_socket: %s\n", p_this, p_this->socket_, uv_err_name(status));
+        uv_handle_set_data((uv_handle_t*)poll_, this);
+        r = uv_poll_start(poll_, UV_WRITABLE, on_writable_cb);
     }
-    else
-        trace("%p:%p on_written_cb: %s\n", p_this, p_this->socket_, uv_err_name(status));
-    if (status < 0)
+    if (r < 0)
+        sending_req_.reset();
+    return r;
+}
+
+int content_writer::send_file()
+{
+    static const size_t max_size = 1024 * 1024;
+
+#ifdef __linux__
+    uv_os_fd_t fd;
+    int r = uv_fileno((uv_handle_t*)poll_, &fd);
+    if (r < 0)
+        return r;
+
+    write_req& req = *sending_req_;
+    off_t offset = (off_t)req.file_offset;
+    ssize_t n = sendfile(fd, req.file, &offset, std::min((size_t)req.buf.len, max_size));
+    if (n > 0)
     {
-        p_this->content_provider_ = nullptr;
-        p_this->on_write_end(status);
+        req.file_offset += n;
+        req.buf.len -= n;
+        on_write_progress();
+        return req.buf.len == 0 ? 1 : 0;
     }
+    else if (n == 0)
+        return UV_EOF; // the file is truncated
+    else if (errno == EAGAIN || errno == EINTR)
+        return 0;
+    else if (errno == EINVAL || errno == ENOSYS)
+    {
+        // not supported by the file, fall back to the provider from here
+        trace("%p:%p sendfile: %s, fall back\n", this, socket_, uv_err_name(uv_translate_sys_error(errno)));
+        send_file_ = -1;
+        content_written_ = req.file_offset;
+        return 1;
+    }
+    return uv_translate_sys_error(errno);
+#else
+    return UV_ENOSYS;
+#endif
+}
+
+void content_writer::on_written_cb(uv_write_t* req, int status)
+{
+    content_writer* p_this = (content_writer*)uv_req_get_data((uv_req_t*)req);
+    if (p_this == nullptr)
+    {
+        delete (write_batch*)req;
+        return;
+    }
+
+    p_this->writing_->reqs.clear();
+    p_this->writing_->bufs.clear();
+    p_this->on_written(status);
+}
+
+void content_writer::on_writable_cb(uv_poll_t* handle, int status, int events)
+{
+    content_writer* p_this = (content_writer*)uv_handle_get_data((uv_handle_t*)handle);
+    if (p_this == nullptr || !p_this->sending_req_)
+        return;
+
+    int r = status < 0 ? status : p_this->send_file();
+    if (r == 0)
+        return; // wait for writable again
+
+    uv_poll_stop(handle);
+    p_this->sending_req_.reset();
+    p_this->on_written(r < 0 ? r : 0);
 }
 
 } // namespace http
\ No newline at end of file
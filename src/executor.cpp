@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <uv.h>
+#include "executor.h"
+#include "loop.h"
+#include "trace.h"
+
+namespace http
+{
+
+class _executor_thread
+{
+public:
+    _executor_thread(executor* executor, size_t index) : executor_(executor), index_(index), thread_() {}
+
+    executor* executor_;
+    size_t index_;
+    uv_thread_t thread_;
+    bool started_ = false;
+};
+
+// the executor and the queue of the current thread, to post nested jobs to its own queue
+static thread_local const executor* _current_executor_ = nullptr;
+static thread_local size_t _current_index_ = 0;
+
+executor::executor(size_t thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (size_t i = 0; i < thread_count; i++)
+        queues_.push_back(std::make_unique<queue>());
+
+    for (size_t i = 0; i < thread_count; i++)
+    {
+        _executor_thread* thread = new _executor_thread(this, i);
+        thread->started_ = uv_thread_create(&thread->thread_, thread_cb, thread) == 0;
+        if (!thread->started_)
+        {
+            trace("executor: failed to start thread %zu\n", i);
+            delete thread;
+            break;
+        }
+        threads_.push_back(thread);
+    }
+}
+
+executor::~executor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    condition_.notify_all();
+
+    for (auto thread : threads_)
+    {
+        uv_thread_join(&thread->thread_);
+        delete thread;
+    }
+    threads_.clear();
+}
+
+bool executor::post(loop* loop, std::function<void()>&& work, std::function<void()>&& done)
+{
+    if (threads_.empty())
+        return false;
+
+    size_t index = _current_executor_ == this ? _current_index_ : next_.fetch_add(1, std::memory_order_relaxed) % threads_.size();
+    {
+        queue& q = *queues_[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.jobs.push_back({ loop, std::move(work), std::move(done) });
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+    }
+    condition_.notify_one();
+    return true;
+}
+
+bool executor::take(size_t index, job& job)
+{
+    // the oldest of its own, or the newest of another
+    for (size_t i = 0; i < threads_.size(); i++)
+    {
+        queue& q = *queues_[(index + i) % threads_.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.jobs.empty())
+            continue;
+
+        if (i == 0)
+        {
+            job = std::move(q.jobs.front());
+            q.jobs.pop_front();
+        }
+        else
+        {
+            job = std::move(q.jobs.back());
+            q.jobs.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+void executor::run(size_t index)
+{
+    _current_executor_ = this;
+    _current_index_ = index;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this]() { return pending_ > 0 || stopping_; });
+            if (pending_ == 0)
+                break; // stopping with no job left
+            pending_--;
+        }
+
+        // one job is counted for this, another thread may take the one seen here first,
+        // but then the one it was counted for is left in a queue
+        job job;
+        while (!take(index, job))
+            std::this_thread::yield();
+
+        if (job.work)
+            job.work();
+        if (job.done && job.loop != nullptr)
+        {
+            int r = job.loop->async(std::move(job.done));
+            if (r != 0)
+                trace("executor: async %s\n", uv_err_name(r));
+        }
+    }
+}
+
+void executor::thread_cb(void* arg)
+{
+    _executor_thread* thread = (_executor_thread*)arg;
+    thread->executor_->run(thread->index_);
+}
+
+} // namespace http
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "file-cache.h"
+#include "file-map.h"
+#include "trace.h"
+
+namespace http
+{
+
+file_cache::file_cache(size_t max_bytes, size_t max_entries)
+{
+    max_bytes_ = max_bytes;
+    max_entries_ = max_entries;
+}
+
+std::shared_ptr<file_map> file_cache::find(const std::string& path)
+{
+    auto p = index_.find(path);
+    if (p == index_.cend())
+    {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    entries_.splice(entries_.begin(), entries_, p->second);
+    return p->second->fmap;
+}
+
+bool file_cache::insert(const std::string& path, std::shared_ptr<file_map> fmap)
+{
+    erase(path);
+    if (fmap->size() > max_bytes_)
+        return false;
+
+    entries_.push_front({ path, fmap, pinned_paths_.count(path) != 0 });
+    index_[entries_.front().path] = entries_.begin();
+    entry_count_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(fmap->size(), std::memory_order_relaxed);
+
+    evict();
+    return true;
+}
+
+bool file_cache::erase(const std::string& path)
+{
+    auto p = index_.find(path);
+    if (p == index_.cend())
+        return false;
+
+    auto it = p->second;
+    index_.erase(p);
+    entry_count_.fetch_sub(1, std::memory_order_relaxed);
+    bytes_.fetch_sub(it->fmap->size(), std::memory_order_relaxed);
+    entries_.erase(it);
+    return true;
+}
+
+void file_cache::pin(const std::string& path, bool pinned)
+{
+    if (pinned)
+        pinned_paths_.insert(path);
+    else
+        pinned_paths_.erase(path);
+
+    auto p = index_.find(path);
+    if (p != index_.cend())
+        p->second->pinned = pinned;
+    if (!pinned)
+        evict();
+}
+
+void file_cache::clear()
+{
+    index_.clear();
+    entries_.clear();
+    entry_count_.store(0, std::memory_order_relaxed);
+    bytes_.store(0, std::memory_order_relaxed);
+}
+
+void file_cache::set_limits(size_t max_bytes, size_t max_entries)
+{
+    max_bytes_ = max_bytes;
+    max_entries_ = max_entries;
+    evict();
+}
+
+file_cache_stats file_cache::stats() const
+{
+    file_cache_stats stats;
+    stats.hits = hits_.load(std::memory_order_relaxed);
+    stats.misses = misses_.load(std::memory_order_relaxed);
+    stats.evictions = evictions_.load(std::memory_order_relaxed);
+    stats.entries = entry_count_.load(std::memory_order_relaxed);
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void file_cache::evict()
+{
+    // from the least recently used, skip the pinned ones
+    auto it = entries_.end();
+    while (it != entries_.begin() && (bytes_.load(std::memory_order_relaxed) > max_bytes_ || entry_count_.load(std::memory_order_relaxed) > max_entries_))
+    {
+        --it;
+        if (it->pinned)
+            continue;
+
+        trace("file cache evict %s\n", it->path.c_str());
+        index_.erase(it->path);
+        entry_count_.fetch_sub(1, std::memory_order_relaxed);
+        bytes_.fetch_sub(it->fmap->size(), std::memory_order_relaxed);
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+        it = entries_.erase(it);
+    }
+}
+
+} // namespace http
\ No newline at end of file
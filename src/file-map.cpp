@@ -3,9 +3,11 @@
 #include <fcntl.h>
 #include <assert.h>
 #include "file-map.h"
+#include "loop.h"
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <io.h>
 #else
 #include <unistd.h>
 #include <sys/mman.h>
@@ -15,7 +17,41 @@
 namespace http
 {
 
-file_map::file_map(const std::string& path, size_t length, long modified_time)
+#ifdef _WIN32
+static char* map_file(HANDLE h_file, size_t& length)
+{
+    char* ptr = nullptr;
+    DWORD high = sizeof(length) > 4 ? (DWORD)(length >> 32) : 0;
+    DWORD low = (DWORD)length;
+    if (length == 0) {
+        low = ::GetFileSize(h_file, &high);
+        length = (static_cast<DWORD64>(high) << 32) | low;
+    }
+
+    assert(!(sizeof(length) == 4 && high != 0));
+    HANDLE h_map = ::CreateFileMapping(h_file, NULL, PAGE_READONLY, high, low, NULL);
+    if (h_map != NULL)
+    {
+        ptr = (char*)::MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, length);
+        ::CloseHandle(h_map);
+    }
+    return ptr;
+}
+#else
+static char* map_file(int fd, size_t& length)
+{
+    if (length == 0)
+    {
+        struct stat st;
+        if (::fstat(fd, &st) == 0)
+            length = st.st_size;
+    }
+    char* ptr = (char*)::mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    return ptr != (char*)-1LL ? ptr : nullptr;
+}
+#endif
+
+file_map::file_map(const std::string& path, size_t length, int64_t modified_time)
 {
     const char* psz = path.c_str();
     modified_time_ = modified_time;
@@ -29,42 +65,33 @@ file_map::file_map(const std::string& path, size_t length, long modified_time)
     HANDLE h_file = ::CreateFileW(pwsz, FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
     if (h_file != INVALID_HANDLE_VALUE)
     {
-        DWORD high = sizeof(length) > 4 ? (DWORD)(length >> 32) : 0;
-        DWORD low = (DWORD)length;
-        if (length == 0) {
-            low = ::GetFileSize(h_file, &high);
-            length = (static_cast<DWORD64>(high) << 32) | low;
-        }
-
-        assert(!(sizeof(length) == 4 && high != 0));
-        HANDLE h_map = ::CreateFileMapping(h_file, NULL, PAGE_READONLY, high, low, NULL);
-        if (h_map != NULL)
-        {
-            ptr_ = (char*)::MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, length);
-            ::CloseHandle(h_map);
-        }
-         ::CloseHandle(h_file);
+        ptr_ = map_file(h_file, length);
+        ::CloseHandle(h_file);
     }
     delete[] pwsz;
 #else
     int fd = ::open(psz, O_RDONLY);
     if (fd != -1)
     {
-        if (length == 0)
-        {
-            struct stat st;
-            if (::fstat(fd, &st) == 0)
-                length = st.st_size;
-        }
-        ptr_ = (char*)::mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
-        if (ptr_ == (char*)-1LL)
-            ptr_ = nullptr;
+        ptr_ = map_file(fd, length);
         ::close(fd);
     }
 #endif
     size_ = length;
 }
 
+file_map::file_map(int fd, size_t length, int64_t modified_time)
+{
+    modified_time_ = modified_time;
+#ifdef _WIN32
+    HANDLE h_file = (HANDLE)::_get_osfhandle(fd);
+    ptr_ = h_file != INVALID_HANDLE_VALUE ? map_file(h_file, length) : nullptr;
+#else
+    ptr_ = map_file(fd, length);
+#endif
+    size_ = length;
+}
+
 file_map::~file_map()
 {
 #ifdef _WIN32
@@ -92,4 +119,23 @@ int file_map::read_chunk(int64_t offset, size_t size, content_sink sink)
     }
 }
 
+uint64_t file_map::content_hash(loop* loop)
+{
+    if (content_hash_ == 0 && ptr_ != nullptr && !hashing_)
+    {
+        // a file of GBs takes seconds to hash, so not in the loop thread
+        auto p_this = shared_from_this();
+        auto hash = std::make_shared<uint64_t>(14695981039346656037ULL);
+        hashing_ = loop->queue_work([p_this, hash]() -> intptr_t {
+            for (size_t i = 0; i < p_this->size_; i++)
+                *hash = (*hash ^ (uint8_t)p_this->ptr_[i]) * 1099511628211ULL;
+            return 0;
+        }, [p_this, hash](intptr_t) {
+            p_this->content_hash_ = *hash;
+            p_this->hashing_ = false;
+        });
+    }
+    return content_hash_;
+}
+
 } // namespace http
\ No newline at end of file
@@ -18,27 +18,39 @@ file_reader::file_reader(uv_loop_t* loop, const std::string& path, std::shared_p
 
     uv_fs_t open_req{};
     fd_ = uv_fs_open(loop_, &open_req, path.c_str(), UV_FS_O_RDONLY | UV_FS_O_SEQUENTIAL, 0, nullptr);
+    own_fd_ = true;
     uv_fs_req_cleanup(&open_req);
 }
 
+file_reader::file_reader(uv_loop_t* loop, uv_file fd, std::shared_ptr<buffer_pool> buffer_pool)
+{
+    loop_ = loop;
+    buffer_pool_ = buffer_pool;
+
+    read_req_ = (read_req*)calloc(sizeof(read_req), 1);
+    if (read_req_ != nullptr)
+        uv_req_set_data((uv_req_t*)read_req_, this);
+
+    fd_ = fd;
+    own_fd_ = false;
+}
+
 file_reader::~file_reader()
 {
     if (reading_)
     {
-        if (uv_cancel((uv_req_t*)read_req_) == 0)
-        {
-            buffer_pool_->recycle_buffer(read_req_->buf);
-            free(read_req_);
-        }
-        else
-            uv_req_set_data((uv_req_t*)&read_req_, nullptr);
+        // on_read_cb is called even if cancelled, and frees the request
+        uv_cancel((uv_req_t*)read_req_);
+        uv_req_set_data((uv_req_t*)read_req_, nullptr);
     }
-    else
+    else if (read_req_ != nullptr)
     {
         buffer_pool_->recycle_buffer(read_req_->buf);
         free(read_req_);
     }
 
+    if (!own_fd_ || fd_ < 0)
+        return;
     uv_fs_t* close_req = (uv_fs_t*)calloc(sizeof(uv_fs_t), 1);
     uv_fs_close(loop_, close_req, fd_, [](uv_fs_t* req) {
         uv_fs_req_cleanup(req);
@@ -91,7 +103,11 @@ void file_reader::on_read_cb(uv_fs_t* req)
     if (p_this != nullptr)
         p_this->on_read();
     else
+    {
         buffer_pool::free_buffer(((read_req*)req)->buf.base);
+        uv_fs_req_cleanup(req);
+        free(req);
+    }
 }
 
 } // namespace http
\ No newline at end of file
@@ -21,7 +21,12 @@ loop::~loop()
         uv_close((uv_handle_t*)work_async_, on_closed_and_free_cb);
     }
     if (loop_ != nullptr && loop_ != uv_default_loop())
+    {
+        // the owners close their handles before, this runs their close callbacks and the pending requests,
+        // for uv_loop_close() to succeed
+        uv_run(loop_, UV_RUN_DEFAULT);
         uv_loop_delete(loop_);
+    }
 }
 
 int loop::async(std::function<void()>&& work)
@@ -29,20 +34,34 @@ int loop::async(std::function<void()>&& work)
     std::lock_guard<std::mutex> lock(work_mutex_);
     if (work_async_ == nullptr)
     {
-        uv_async_t* async = (uv_async_t*)calloc(sizeof(uv_async_t), 1);
-        int r = uv_async_init(loop_, async, on_async_cb);
+        int r = init_async();
         if (r != 0)
-        {
-            free(async);
             return r;
-        }
-        work_async_ = async;
-        uv_handle_set_data((uv_handle_t*)work_async_, this);
     }
     work_list_.push_back(std::move(work));
     return uv_async_send(work_async_);
 }
 
+int loop::prepare_async()
+{
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    return work_async_ == nullptr ? init_async() : 0;
+}
+
+int loop::init_async()
+{
+    uv_async_t* async = (uv_async_t*)calloc(sizeof(uv_async_t), 1);
+    int r = uv_async_init(loop_, async, on_async_cb);
+    if (r != 0)
+    {
+        free(async);
+        return r;
+    }
+    work_async_ = async;
+    uv_handle_set_data((uv_handle_t*)work_async_, this);
+    return 0;
+}
+
 struct work_req_data
 {
     std::function<intptr_t()> work;
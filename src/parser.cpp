@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <charconv>
 #include <uv.h>
 #include "chunked-decoder.h"
 #include "parser.h"
@@ -22,13 +23,37 @@ parser::~parser()
 {
     if (chunked_decoder_ != nullptr)
         delete chunked_decoder_;
+    unpin_buffer();
 }
 
 int parser::start_read(uv_stream_t* socket)
 {
     reset_status();
     state_ = state_parsing;
-    return uv_read_start(socket, on_alloc_cb, on_read_cb);
+    if (peer_eof_)
+        return pipeline_.empty() ? UV_EOF : on_pipeline_read();
+
+    int r = uv_read_start(socket, on_alloc_cb, on_read_cb);
+    if (r == UV_EALREADY)
+        r = 0; // still reading for the pipelined requests
+    return r < 0 || pipeline_.empty() ? r : on_pipeline_read();
+}
+
+int parser::on_pipeline_read()
+{
+    // pipeline_ may be appended while parsing, so move the data to a stable buffer for message_view
+    pipeline_input_.swap(pipeline_);
+    pipeline_.clear();
+
+    int r = on_data_read(pipeline_input_.data(), pipeline_input_.size(), nullptr);
+    if (r < 0)
+        return r;
+
+    if (state_ >= state_parsed && is_read_done())
+        on_read_end(0);
+    else if (peer_eof_)
+        return UV_EOF; // the last request is incomplete
+    return 0;
 }
 
 void parser::reset_status()
@@ -37,6 +62,7 @@ void parser::reset_status()
     content_to_receive_ = 0;
     state_ = state_none;
     received_cache_.clear();
+    unpin_buffer();
 
     if (chunked_decoder_ != nullptr)
     {
@@ -46,66 +72,101 @@ void parser::reset_status()
     chunked_sink_ = nullptr;
 }
 
+void parser::unpin_buffer()
+{
+    if (pinned_buf_.base != nullptr)
+        buffer_pool_->recycle_buffer(pinned_buf_);
+}
+
 int parser::on_content_read(const char* data, size_t size)
 {
     if (chunked_decoder_ != nullptr)
     {
         int r = chunked_decoder_->decode(data, size, chunked_sink_);
         if (r == -1)
-            r = UV_E_HTTP_CHUNKED;
-        return r;
+            return UV_E_HTTP_CHUNKED;
+        if (r > 0 && request_mode_)
+            pipeline_.append(data + size - r, r); // left after the last chunk
+        return 0;
     }
 
+    // the data after the content belongs to the next pipelined request
+    int64_t content_left = content_to_receive_ - content_received_;
+    if ((int64_t)size > content_left)
+    {
+        if (request_mode_)
+            pipeline_.append(data + content_left, size - content_left);
+        size = (size_t)content_left;
+    }
+    if (size == 0)
+        return 0;
+
     content_received_ += size;
     return on_content_received(data, size) ? 0 : UV_E_USER_CANCELLED;
 }
 
 int parser::on_socket_read(ssize_t nread, const uv_buf_t* buf)
 {
-    if (state_ == state_parsed)
-        return on_content_read(buf->base, nread);
-    else if (state_ == state_outputing)
+    if (state_ == state_outputing)
+    {
+        // keep the pipelined requests until the current response is done
+        if (request_mode_)
+            pipeline_.append(buf->base, nread);
         return 0;
+    }
+    return on_data_read(buf->base, nread, buf);
+}
 
-    size_t last_size = received_cache_.size();
-    if (last_size > 0)
-        received_cache_.append(buf->base, nread);
-
-    const char* data = last_size > 0 ? received_cache_.c_str() : buf->base;
-    size_t size = last_size + nread;
+int parser::on_data_read(const char* data, size_t size, const uv_buf_t* buf)
+{
+    if (state_ == state_parsed)
+        return on_content_read(data, size);
 
-    int r = 0;
-    string_map* headers = nullptr;
-    if (request_mode_)
-    {
-        request_base* req = on_get_request();
-        req->method.clear();
-        req->url.clear();
-        headers = &req->headers;
-        headers->clear();
-        r = parse_request(data, size, last_size, *req);
-    }
+    size_t nread = size;
+    size_t last_size = received_cache_.size();
+    if (last_size == 0)
+        on_message_begin();
     else
     {
-        response* res = on_get_response();
-        res->status_code = 0;
-        res->status_msg.clear();
-        res->content_length.reset();
-        headers = &res->headers;
-        headers->clear();
-        r = parse_response(data, size, last_size, *res);
+        received_cache_.append(data, nread);
+        data = received_cache_.c_str();
+        size = received_cache_.size();
     }
 
+    message_view* view = on_get_view();
+    view->clear();
+    int r = request_mode_ ? parse_request(data, size, last_size, *view) : parse_response(data, size, last_size, *view);
     if (r > 0)
     {
         state_ = state_parsed;
 
-        auto end = headers->cend();
-        auto p = end;
+        if (request_mode_)
+        {
+            // the view points to the buffer, keep it until unpin_buffer(), or received_cache_ until reset_status()
+            if (last_size == 0 && buf != nullptr)
+            {
+                pinned_buf_.base = buf->base;
+                pinned_buf_.len = buf->len;
+            }
+
+            request_base* req = on_get_request();
+            req->method.assign(view->method);
+            req->url.assign(view->url);
+        }
+        else
+        {
+            response* res = on_get_response();
+            res->status_code = view->status_code;
+            res->status_msg.assign(view->status_msg);
+            res->content_length.reset();
+            res->headers.clear();
+            for (auto& h : view->headers)
+                res->headers[std::string(h.name)] = h.value;
+        }
 
-        p = headers->find(HEADER_TRANSFER_ENCODING);
+        const header_field* h = view->header(header_transfer_encoding);
         if (chunked_decoder_ != nullptr) delete chunked_decoder_;
-        chunked_decoder_ = p != end && case_equals(p->second, "chunked") ? new chunked_decoder : nullptr;
+        chunked_decoder_ = h != nullptr && case_equals(h->value, "chunked") ? new chunked_decoder : nullptr;
         if (chunked_decoder_ != nullptr)
             chunked_sink_ = [this](const char* data, size_t size) {
                 if (size > 0)
@@ -118,8 +179,13 @@ int parser::on_socket_read(ssize_t nread, const uv_buf_t* buf)
             chunked_sink_ = nullptr;
 
         std::optional<int64_t> content_length;
-        p = headers->find(HEADER_CONTENT_LENGTH);
-        content_length = p != end ? strtoll(p->second.c_str(), nullptr, 10) : std::optional<int64_t>();
+        h = view->header(header_content_length);
+        if (h != nullptr)
+        {
+            int64_t length = 0;
+            std::from_chars(h->value.data(), h->value.data() + h->value.size(), length);
+            content_length = length;
+        }
         content_to_receive_ = content_length.value_or((request_mode_ && chunked_decoder_ == nullptr) ? 0 : INT64_MAX);
 
         if (!on_headers_parsed(content_length))
@@ -134,7 +200,7 @@ int parser::on_socket_read(ssize_t nread, const uv_buf_t* buf)
     else if (r == -2)
     {
         if (last_size == 0)
-            received_cache_.append(buf->base, nread);
+            received_cache_.append(data, nread);
         return 0;
     }
     return r < 0 ? UV_E_HTTP_HEADERS : 0;
@@ -164,6 +230,20 @@ void parser::on_read_cb(uv_stream_t* socket, ssize_t nread, const uv_buf_t* buf)
         return;
 
     int r = (int)nread;
+    if (p_this->state_ == state_outputing)
+    {
+        // reading pipelined requests while responding
+        if (nread > 0)
+            p_this->on_socket_read(nread, buf);
+        p_this->buffer_pool_->recycle_buffer(const_cast<uv_buf_t&>(*buf));
+
+        if (nread < 0)
+            p_this->peer_eof_ = true;
+        if (nread < 0 || p_this->pipeline_.size() >= p_this->max_pipeline_size_)
+            uv_read_stop(socket);
+        return;
+    }
+
     if (nread > 0)
     {
         r = p_this->on_socket_read(nread, buf);
@@ -174,12 +254,14 @@ void parser::on_read_cb(uv_stream_t* socket, ssize_t nread, const uv_buf_t* buf)
     }
     else if (nread < 0)
         trace("%p:%p on_read_cb: %s\n", p_this, socket, uv_err_name(r));
-    p_this->buffer_pool_->recycle_buffer(const_cast<uv_buf_t&>(*buf));
+    if (buf->base != p_this->pinned_buf_.base)
+        p_this->buffer_pool_->recycle_buffer(const_cast<uv_buf_t&>(*buf));
 
     if (r == UV_EOF)
         p_this->set_read_done();
 
-    bool done = p_this->is_read_done();
+    // nothing to count before the headers parsed
+    bool done = p_this->state_ >= state_parsed && p_this->is_read_done();
     if (r < 0 || done)
         p_this->on_read_end(r);
 }
@@ -191,9 +273,8 @@ static int check_is_http(const char* data, size_t size, size_t last_size, int r)
     return r;
 }
 
-int parser::parse_request(const char* data, size_t size, size_t last_size, request_base& req)
+int parser::parse_request(const char* data, size_t size, size_t last_size, message_view& view)
 {
-    int minor_version = 0;
     const char* method = nullptr;
     const char* path = nullptr;
     size_t method_len = 0;
@@ -201,51 +282,44 @@ int parser::parse_request(const char* data, size_t size, size_t last_size, reque
     size_t num_headers = _max_num_headers;
     phr_header phr_headers[_max_num_headers];
 
-    int r = phr_parse_request(data, size, &method, &method_len, &path, &path_len, &minor_version,
+    int r = phr_parse_request(data, size, &method, &method_len, &path, &path_len, &view.minor_version,
                                 phr_headers, &num_headers, last_size);
     if (r > 0)
     {
         if (method != nullptr)
-            req.method = std::string(method, method_len);
+            view.method = std::string_view(method, method_len);
         if (path != nullptr)
-            req.url = std::string(path, path_len);
+            view.url = std::string_view(path, path_len);
 
+        view.headers.reserve(num_headers);
         for (size_t i = 0; i < num_headers; i++)
         {
             const phr_header& header = phr_headers[i];
-            std::string name = std::string(header.name, header.name_len);
-            std::string value = std::string(header.value, header.value_len);
-            req.headers[name] = value;
+            view.add_header(std::string_view(header.name, header.name_len), std::string_view(header.value, header.value_len));
         }
     }
-    else if (r == -2)
-    {
-        r = check_is_http(data, size, last_size, r);
-    }
     return r;
 }
 
-int parser::parse_response(const char* data, size_t size, size_t last_size, response& res)
+int parser::parse_response(const char* data, size_t size, size_t last_size, message_view& view)
 {
-    int minor_version = 0;
     const char* msg = nullptr;
     size_t msg_len = 0;
     size_t num_headers = _max_num_headers;
     phr_header phr_headers[_max_num_headers];
 
-    int r = phr_parse_response(data, size, &minor_version, &res.status_code, &msg, &msg_len,
+    int r = phr_parse_response(data, size, &view.minor_version, &view.status_code, &msg, &msg_len,
                                 phr_headers, &num_headers, last_size);
     if (r > 0)
     {
         if (msg != nullptr)
-            res.status_msg = std::string(msg, msg_len);
+            view.status_msg = std::string_view(msg, msg_len);
 
+        view.headers.reserve(num_headers);
         for (size_t i = 0; i < num_headers; i++)
         {
             const phr_header& header = phr_headers[i];
-            std::string name = std::string(header.name, header.name_len);
-            std::string value = std::string(header.value, header.value_len);
-            res.headers[name] = value;
+            view.add_header(std::string_view(header.name, header.name_len), std::string_view(header.value, header.value_len));
         }
     }
     else if (r == -2)
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "query-string.h"
+#include "uri.h"
+#include "utils.h"
+
+namespace http
+{
+
+void query_string::parse(std::string_view s)
+{
+    text_.assign(s.data(), s.size());
+    fields_.clear();
+
+    const char* data = text_.data();
+    uint32_t size = (uint32_t)text_.size();
+    uint32_t pos = 0;
+    while (pos < size)
+    {
+        const char* end = (const char*)memchr(data + pos, '&', size - pos);
+        uint32_t field_end = end != nullptr ? (uint32_t)(end - data) : size;
+        if (field_end > pos)
+        {
+            const char* eq = (const char*)memchr(data + pos, '=', field_end - pos);
+            field f;
+            f.name_pos = pos;
+            if (eq != nullptr)
+            {
+                f.name_len = (uint32_t)(eq - data) - pos;
+                f.value_pos = f.name_pos + f.name_len + 1;
+                f.value_len = field_end - f.value_pos;
+            }
+            else
+            {
+                f.name_len = field_end - pos;
+                f.value_pos = field_end;
+                f.value_len = 0;
+            }
+            fields_.push_back(f);
+        }
+        pos = field_end + 1;
+    }
+}
+
+void query_string::clear()
+{
+    text_.clear();
+    fields_.clear();
+}
+
+std::string query_string::value(size_t i) const
+{
+    return uri::decode(raw_value(i));
+}
+
+static bool needs_decode(std::string_view s)
+{
+    return s.find_first_of("%+") != std::string_view::npos;
+}
+
+size_t query_string::find(std::string_view name) const
+{
+    for (size_t i = 0; i < fields_.size(); i++)
+    {
+        std::string_view n = this->name(i);
+        if (n == name || (needs_decode(n) && uri::decode(n) == name))
+            return i;
+    }
+    return std::string::npos;
+}
+
+bool query_string::has(std::string_view name) const
+{
+    return find(name) != std::string::npos;
+}
+
+std::optional<std::string_view> query_string::raw_value(std::string_view name) const
+{
+    size_t i = find(name);
+    return i != std::string::npos ? raw_value(i) : std::optional<std::string_view>();
+}
+
+std::optional<std::string> query_string::value(std::string_view name) const
+{
+    size_t i = find(name);
+    return i != std::string::npos ? value(i) : std::optional<std::string>();
+}
+
+std::string query_string::value_or(std::string_view name, const std::string& default_value) const
+{
+    size_t i = find(name);
+    return i != std::string::npos ? value(i) : default_value;
+}
+
+} // namespace http
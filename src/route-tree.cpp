@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "route-tree.h"
+
+namespace http
+{
+
+struct route_tree::route
+{
+    std::string method;
+    int id;
+    std::vector<std::string> names; // of the captures in order, bound to the values found
+};
+
+struct route_tree::node
+{
+    std::string segment;
+    std::unordered_map<std::string_view, std::unique_ptr<node>> children; // keys are segment of children
+
+    std::unique_ptr<node> param_child;  // ":name"
+    std::vector<route> wildcard_routes; // "*name"
+
+    std::vector<route> routes;
+};
+
+route_tree::route_tree() : root_(new node)
+{
+}
+
+route_tree::~route_tree()
+{
+}
+
+bool route_tree::is_pattern_segment(std::string_view segment)
+{
+    return segment.size() > 1 && (segment[0] == ':' || segment[0] == '*');
+}
+
+bool route_tree::insert_route(std::vector<route>& routes, const std::string& method, int id, std::vector<std::string>&& names)
+{
+    for (auto& r : routes)
+    {
+        if (case_equals(r.method, method))
+            return false;
+    }
+    routes.push_back({ method, id, std::move(names) });
+    return true;
+}
+
+bool route_tree::insert(const std::string& method, const std::string& pattern, int id)
+{
+    std::string_view path = pattern;
+    if (!path.empty() && path[0] == '/')
+        path.remove_prefix(1);
+
+    node* n = root_.get();
+    std::vector<std::string> names;
+    while (true)
+    {
+        size_t pos = path.find('/');
+        std::string_view segment = path.substr(0, pos);
+        if (is_pattern_segment(segment) && segment[0] == '*')
+        {
+            // the rest of pattern is ignored
+            names.emplace_back(segment.substr(1));
+            return insert_route(n->wildcard_routes, method, id, std::move(names));
+        }
+        else if (is_pattern_segment(segment))
+        {
+            if (!n->param_child)
+                n->param_child.reset(new node);
+            names.emplace_back(segment.substr(1));
+            n = n->param_child.get();
+        }
+        else
+        {
+            auto p = n->children.find(segment);
+            if (p == n->children.end())
+            {
+                node* child = new node;
+                child->segment = segment;
+                n->children.emplace(child->segment, child);
+                n = child;
+            }
+            else
+                n = p->second.get();
+        }
+
+        if (pos == std::string_view::npos)
+            break;
+        path.remove_prefix(pos + 1);
+    }
+    return insert_route(n->routes, method, id, std::move(names));
+}
+
+int route_tree::find(const std::string& method, std::string_view path, route_params& params) const
+{
+    if (!path.empty() && path[0] == '/')
+        path.remove_prefix(1);
+
+    // the values are captured along the path, then named by the route found
+    size_t size = params.size();
+    const route* r = find(root_.get(), method, path, params);
+    if (r == nullptr)
+        return -1;
+    for (size_t i = 0; i < r->names.size(); i++)
+        params[size + i].first = r->names[i];
+    return r->id;
+}
+
+const route_tree::route* route_tree::find_method(const std::vector<route>& routes, const std::string& method)
+{
+    // the one of method, or any method, HEAD can be served by GET
+    const route* any = nullptr;
+    const route* get = nullptr;
+    for (auto& r : routes)
+    {
+        if (case_equals(r.method, method))
+            return &r;
+        else if (r.method.empty())
+            any = &r;
+        else if (r.method == "GET")
+            get = &r;
+    }
+    return any != nullptr ? any : (case_equals(method, "HEAD") ? get : nullptr);
+}
+
+const route_tree::route* route_tree::find(const node* n, const std::string& method, std::string_view path, route_params& params)
+{
+    size_t pos = path.find('/');
+    std::string_view segment = path.substr(0, pos);
+    std::string_view rest = pos == std::string_view::npos ? std::string_view() : path.substr(pos + 1);
+    bool last = pos == std::string_view::npos;
+
+    // literal segment first, then parameter, then wildcard
+    auto p = n->children.find(segment);
+    if (p != n->children.end())
+    {
+        const route* r = last ? find_method(p->second->routes, method) : find(p->second.get(), method, rest, params);
+        if (r != nullptr)
+            return r;
+    }
+
+    if (n->param_child && !segment.empty())
+    {
+        size_t size = params.size();
+        params.emplace_back(std::string_view(), segment);
+        const route* r = last ? find_method(n->param_child->routes, method) : find(n->param_child.get(), method, rest, params);
+        if (r != nullptr)
+            return r;
+        params.resize(size);
+    }
+
+    const route* r = find_method(n->wildcard_routes, method);
+    if (r != nullptr)
+        params.emplace_back(std::string_view(), path);
+    return r;
+}
+
+} // namespace http
@@ -1,15 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <atomic>
+#include <charconv>
 #include <list>
+#include <string.h>
 #include <uv.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 #include "buffer-pool.h"
 #include "common.h"
+#include "compressor.h"
 #include "content-writer.h"
 #include "file-map.h"
 #include "file-reader.h"
 #include "parser.h"
 #include "reference-count.h"
+#include "route-tree.h"
 #include "server.h"
+#include "timing-wheel.h"
 #include "trace.h"
 #include "uri.h"
 #include "utils.h"
@@ -24,13 +33,360 @@ namespace http
 
 static const size_t _max_request_body_ = 8 * 1024 * 1024;
 
-static int _responser_count_ = 0;
+// min size of the pooled buffers for response headers
+static const size_t _header_buffer_size_ = 512;
+
+static const char _overload_response_[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: Close\r\n\r\n";
+
+#ifndef _WIN32
+#define _ENABLE_HANDOFF_
+#endif
+
+// single producer/consumer queue of accepted sockets, from the accepting loop to a worker
+class _socket_queue
+{
+    static const size_t capacity = 1024;
+
+public:
+    bool push(uv_os_sock_t sock)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= capacity)
+            return false;
+        socks_[tail % capacity] = sock;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(uv_os_sock_t& sock)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+        sock = socks_[head % capacity];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    uv_os_sock_t socks_[capacity];
+};
+
+// metadata and the opened fd of a served file, reused by the requests until expired
+struct _file_info
+{
+    uv_loop_t* loop;
+    std::string path;
+    std::string mime_type;
+    uint64_t length = 0;        // 0 if not found
+    int64_t modified_time = 0;  // in nanoseconds
+    uint64_t inode = 0;
+    std::string last_modified;
+    std::string etag;           // made by serve_file() at the first use
+    bool etag_hashed = false;   // etag is of the content hash, which replaces the first one when done
+    uv_file fd = -1;            // < 0 if not opened
+    uint64_t expires = 0;
+
+    // precompressed "path.br" and "path.gz" in the order of preference, if server_options::precompressed
+    std::string content_encoding;
+    std::shared_ptr<_file_info> sidecars[2];
+
+    _file_info(uv_loop_t* loop, const std::string& path) : loop(loop), path(path) {}
+
+    ~_file_info()
+    {
+        if (fd < 0)
+            return;
+        uv_fs_t* close_req = (uv_fs_t*)calloc(sizeof(uv_fs_t), 1);
+        uv_fs_close(loop, close_req, fd, [](uv_fs_t* req) {
+            uv_fs_req_cleanup(req);
+            free(req);
+        });
+    }
+};
+
+// validators of a conditional GET, copied from the request before serve_file() is deferred
+struct _file_conditions
+{
+    std::string if_none_match;
+    std::string if_modified_since;
+    std::string accept_encoding;
+    bool safe;  // GET or HEAD
+
+    _file_conditions(const request2& req)
+    {
+        safe = case_equals(req.method, "GET") || case_equals(req.method, "HEAD");
+        if_none_match = header(req, header_if_none_match);
+        if_modified_since = header(req, header_if_modified_since);
+        accept_encoding = header(req, header_accept_encoding);
+    }
+
+    // from the view while routing, otherwise from the copied headers
+    static std::string_view header(const request2& req, header_id id)
+    {
+        const header_field* h = req.view.header(id);
+        if (h != nullptr)
+            return h->value;
+        auto p = req.headers.find(std::string(header_name(id)));
+        return p != req.headers.cend() ? std::string_view(p->second) : std::string_view();
+    }
+
+    // weak comparison of RFC 7232 against the entity-tags of If-None-Match, also of the variant compressed by
+    // compress_response() for the accepted encoding, "xyz-gzip" of "xyz", which is returned by matched
+    bool match_etag(std::string_view etag, std::string_view* matched) const
+    {
+        const char* encoding = accepts_encoding(accept_encoding, "gzip") ? "gzip"
+            : accepts_encoding(accept_encoding, "deflate") ? "deflate" : nullptr;
+        std::string_view tags = if_none_match;
+        size_t pos = 0;
+        while (pos < tags.size())
+        {
+            char ch = tags[pos];
+            if (ch == '*')
+                return true;
+            if (ch == '"' || tags.compare(pos, 3, "W/\"") == 0)
+            {
+                size_t begin = ch == '"' ? pos : pos + 2;
+                size_t end = tags.find('"', begin + 1);
+                if (end == std::string_view::npos)
+                    return false;
+                std::string_view tag = tags.substr(begin, end + 1 - begin);
+                if (tag == etag || (encoding != nullptr && is_variant(tag, etag, encoding)))
+                {
+                    *matched = tag;
+                    return true;
+                }
+                pos = end + 1;
+            }
+            else
+                pos++;
+        }
+        return false;
+    }
+
+    static bool is_variant(std::string_view tag, std::string_view etag, std::string_view encoding)
+    {
+        return etag.size() > 1 && tag.size() == etag.size() + 1 + encoding.size()
+            && tag.compare(0, etag.size() - 1, etag.substr(0, etag.size() - 1)) == 0
+            && tag[etag.size() - 1] == '-' && tag.compare(etag.size(), encoding.size(), encoding) == 0;
+    }
+
+    bool is_not_modified(const _file_info& info, std::string_view* matched) const
+    {
+        if (!if_none_match.empty())
+            return match_etag(info.etag, matched);
+
+        time_t since = 0;
+        return safe && !if_modified_since.empty() && parse_http_date(if_modified_since, since)
+            && info.modified_time / 1000000000LL <= since;
+    }
+};
+
+// stats and opens the file of a _file_info and its sidecars, on the threadpool if there is a callback, otherwise at once
+class _file_opener : public uv_fs_t
+{
+public:
+    using on_opened = std::function<void(std::shared_ptr<_file_info> info)>;
+
+    static void open(std::shared_ptr<_file_info> info, on_opened&& callback)
+    {
+        _file_opener* req = new _file_opener();
+        req->infos_.push_back(info);
+        for (auto& sidecar : info->sidecars)
+        {
+            if (sidecar)
+                req->infos_.push_back(sidecar);
+        }
+        req->callback_ = std::move(callback);
+        req->stat();
+    }
+
+private:
+    _file_opener() : uv_fs_t() {}
+
+    void stat()
+    {
+        _file_info* info = infos_[opening_].get();
+        uv_fs_cb cb = callback_ ? on_stat_cb : nullptr;
+        int r = uv_fs_stat(info->loop, this, info->path.c_str(), cb);
+        if (r < 0)
+            result = r;
+        if (r < 0 || cb == nullptr)
+            on_stat();
+    }
+
+    void on_stat()
+    {
+        _file_info* info = infos_[opening_].get();
+        bool found = result == 0 && (statbuf.st_mode & S_IFREG) && statbuf.st_size > 0;
+        if (found)
+        {
+            info->length = statbuf.st_size;
+            info->modified_time = statbuf.st_mtim.tv_sec * 1000000000LL + statbuf.st_mtim.tv_nsec;
+            info->inode = statbuf.st_ino;
+
+            char date[32];
+            info->last_modified.assign(date, format_http_date((time_t)statbuf.st_mtim.tv_sec, date));
+        }
+        uv_fs_req_cleanup(this);
+        if (!found)
+        {
+            on_done();
+            return;
+        }
+
+        uv_fs_cb cb = callback_ ? on_open_cb : nullptr;
+        int r = uv_fs_open(info->loop, this, info->path.c_str(), UV_FS_O_RDONLY | UV_FS_O_SEQUENTIAL, 0, cb);
+        if (r < 0)
+            result = r;
+        if (r < 0 || cb == nullptr)
+            on_open();
+    }
+
+    void on_open()
+    {
+        if (result >= 0)
+            infos_[opening_]->fd = (uv_file)result;
+        uv_fs_req_cleanup(this);
+        on_done();
+    }
+
+    void on_done()
+    {
+        // the sidecars only if the file itself is there
+        std::shared_ptr<_file_info> info = infos_.front();
+        if (++opening_ < infos_.size() && info->fd >= 0)
+        {
+            stat();
+            return;
+        }
+
+        // a sidecar older than the file is stale
+        for (auto& sidecar : info->sidecars)
+        {
+            if (sidecar && (sidecar->fd < 0 || sidecar->modified_time < info->modified_time))
+                sidecar = nullptr;
+        }
+
+        on_opened callback = std::move(callback_);
+        delete this;
+        if (callback)
+            callback(info);
+    }
+
+    static void on_stat_cb(uv_fs_t* req)
+    {
+        ((_file_opener*)req)->on_stat();
+    }
+
+    static void on_open_cb(uv_fs_t* req)
+    {
+        ((_file_opener*)req)->on_open();
+    }
+
+private:
+    std::vector<std::shared_ptr<_file_info>> infos_;
+    size_t opening_ = 0;
+    on_opened callback_;
+};
+
+// watches a directory of the served files
+struct _dir_watcher
+{
+    uv_fs_event_t handle;
+    class _worker* worker;
+    std::string prefix; // "dir/" of the cached paths
+};
 
-class _responser : public parser, public content_writer
+// serving state of a loop, the first worker runs on the server's loop
+class _worker
+{
+    friend class server;
+    friend class _responser;
+
+public:
+    _worker(server* server, loop* loop);
+    ~_worker();
+
+    bool listen(const sockaddr* addr, int socket_type, bool reuse_port);
+    bool start_thread();
+    void stop_thread();
+
+    // live and handing over connections, can call in other threads
+    inline int load() const { return responser_count_.load(std::memory_order_relaxed) + handoff_count_.load(std::memory_order_relaxed); }
+
+    // call in the accepting loop thread
+    bool hand_over(uv_tcp_t* tcp);
+
+    // call after a connection of this worker is closed
+    void on_connection_closed();
+
+    // "HTTP/1.1 200 OK\r\n", rendered once for each status code
+    const std::string& status_line(int status_code);
+
+    // value of the Date header, updated once per second
+    std::string_view date();
+
+    // nullptr if not cached or expired
+    std::shared_ptr<_file_info> find_file_info(const std::string& path);
+    void add_file_info(const std::shared_ptr<_file_info>& info);
+
+    // drops the cached file and its metadata
+    void remove_cache(const std::string& path);
+
+private:
+    bool watch_dir(const std::string& path);
+    void close_watchers();
+    void on_dir_changed(_dir_watcher* watcher, const char* filename, int status);
+    static void on_dir_changed_cb(uv_fs_event_t* handle, const char* filename, int events, int status);
+
+    void on_connection(uv_stream_t* socket);
+    void reject(uv_tcp_t* tcp);
+    void on_handoff();
+    static void on_connection_cb(uv_stream_t* socket, int status);
+    static void on_handoff_cb(uv_async_t* handle);
+    static void thread_cb(void* arg);
+
+private:
+    server* server_;
+    loop* loop_;
+    uv_thread_t thread_;
+    bool thread_started_ = false;
+    uv_stream_t* socket_ = nullptr;
+    std::atomic<bool> accept_paused_{false};
+    uv_async_t* handoff_async_ = nullptr;
+    _socket_queue handoff_queue_;
+    std::atomic<int> handoff_count_{0};
+    std::atomic<int> responser_count_{0};
+    std::unique_ptr<timing_wheel> timing_wheel_;
+    std::shared_ptr<buffer_pool> buffer_pool_;
+    std::shared_ptr<buffer_pool> header_pool_;
+    std::unordered_map<int, std::string> status_lines_;
+    char date_[32] = {};
+    size_t date_size_ = 0;
+    uint64_t date_updated_ = 0;
+    file_cache file_cache_;
+    compressed_cache compressed_cache_;
+    std::vector<std::pair<int64_t, int64_t>> ranges_; // resolved for the response being written
+    std::unordered_map<std::string, std::shared_ptr<_file_info>> file_infos_;
+    std::unordered_map<std::string, _dir_watcher*> dir_watchers_;
+};
+
+static thread_local _worker* _local_worker_ = nullptr;
+
+static const router _not_found_router_ = {};
+
+class _responser : public parser, public content_writer, public timing_wheel::entry
 {
     define_reference_count(_responser)
 
     friend class server;
+    friend class _worker;
+    friend struct request2;
+    friend struct response2;
+    friend class deferred_response;
 
     enum _end_reason
     {
@@ -40,8 +396,9 @@ class _responser : public parser, public content_writer
     };
 
 private:
-    const std::unordered_map<std::string, router>& router_map_;
-    const std::list<std::pair<std::regex, router>> router_list_;
+    _worker* worker_;
+    const server& server_;
+    route_params route_params_;
 
     // for input
     request2 request_;
@@ -49,18 +406,28 @@ private:
 
     // for output
     response2 response_;
-    router router_ = {};
+    const router* router_ = &_not_found_router_;
 
     bool keep_alive_ = false;
+    uint32_t requests_ = 0;     // of the connection, to close it after keep_alive_max_requests
+    uint64_t connected_time_;   // uv_now(), to close it after keep_alive_max_age
+    bool http11_ = false;   // the request is of HTTP/1.1, to accept the chunked encoding
+    bool idle_ = false;
+    bool deferred_ = false;
+    bool paused_ = false;   // reading the body is paused by request2::pause()
+    compressor::encoding encoding_ = compressor::encoding_none; // accepted by the request
 
 protected:
-    _responser(uv_loop_t* loop, uv_stream_t* socket, std::shared_ptr<buffer_pool> buffer_pool,
-            const std::unordered_map<std::string, router>& router_map, const std::list<std::pair<std::regex, router>>& router_list) :
-        parser(true, buffer_pool), router_map_(router_map), router_list_(router_list),
-        content_writer(loop)
+    _responser(_worker* worker, uv_stream_t* socket) :
+        parser(true, worker->buffer_pool_), worker_(worker), server_(*worker->server_),
+        content_writer(worker->loop_->get_loop())
     {
         socket_ = socket;
         uv_handle_set_data((uv_handle_t*)socket, this);
+        request_.responser_ = this;
+        response_.responser_ = this;
+        max_pipeline_size_ = server_.options_.max_pipeline_size;
+        set_watermarks(server_.options_.write_high_watermark, server_.options_.write_low_watermark);
 
         sockaddr_in addr = {};
         int len = sizeof(addr);
@@ -72,22 +439,94 @@ protected:
             peer_address_ = name;
         }
 
-        _responser_count_++;
+        connected_time_ = uv_now(worker_->loop_->get_loop());
+        worker_->responser_count_++;
     }
 
     ~_responser()
     {
-        _responser_count_--;
-        trace("%d living responsers\n", _responser_count_);
+        worker_->responser_count_--;
+        trace("%d living responsers\n", worker_->responser_count_.load());
+        worker_->on_connection_closed();
     }
 
     void start()
     {
+        set_timeout(worker_->server_->options_.header_timeout);
         int r = start_read(socket_);
         if (r != 0)
             on_end(r, reason_start_failed);
     }
 
+    void set_timeout(uint32_t timeout)
+    {
+        if (timeout > 0)
+            worker_->timing_wheel_->schedule(this, timeout);
+        else
+            worker_->timing_wheel_->cancel(this);
+    }
+
+    virtual void on_timeout()
+    {
+        trace("%p:%p timeout: state %d, %s\n", this, socket_, state_, request_.url.c_str());
+        if (deferred_)
+        {
+            // answers 504 and closes, the later resume() only releases its reference
+            deferred_ = false;
+            keep_alive_ = false;
+            clear_response();
+            response_.status_code = 504;
+            response_.content_length = 0;
+            start_write();
+            return;
+        }
+        abort(UV_ETIMEDOUT);
+    }
+
+    // ends the connection at once, timed out or the worker destroyed
+    void abort(int error_code)
+    {
+        if (state_ != state_outputing)
+        {
+            uv_read_stop(socket_);
+            on_end(error_code, reason_read_done);
+        }
+        else if (is_writing())
+        {
+            // the pending write will be cancelled and end this
+            close_socket();
+        }
+        else
+        {
+            on_write_end(error_code);
+        }
+    }
+
+    void close_socket()
+    {
+        uv_stream_t* socket = socket_;
+        socket_ = nullptr;
+        if (socket != nullptr)
+        {
+            uv_handle_set_data((uv_handle_t*)socket, nullptr);
+            uv_close((uv_handle_t*)socket, on_closed_and_free_cb);
+        }
+    }
+
+    virtual void on_message_begin()
+    {
+        if (idle_)
+        {
+            idle_ = false;
+            set_timeout(worker_->server_->options_.header_timeout);
+        }
+    }
+
+    virtual message_view* on_get_view()
+    {
+        return &request_.view;
+    }
+
     virtual request_base* on_get_request()
     {
         return &request_;
@@ -101,69 +540,108 @@ protected:
 
     virtual bool on_headers_parsed(std::optional<int64_t> content_length)
     {
-        auto end = request_.headers.cend();
-        auto p = end;
+        const message_view& view = request_.view;
+        const server_options& options = server_.options_;
+        const header_field* h = view.header(header_connection);
+        keep_alive_ = is_persistent(view.minor_version, h != nullptr ? h->value : std::string_view());
+        http11_ = view.minor_version >= 1;
+
+        // the last request of the connection is answered by "Connection: Close"
+        requests_++;
+        if ((options.keep_alive_max_requests > 0 && requests_ >= options.keep_alive_max_requests)
+            || (options.keep_alive_max_age > 0 && uv_now(worker_->loop_->get_loop()) - connected_time_ >= options.keep_alive_max_age))
+            keep_alive_ = false;
 
-        p = request_.headers.find(HEADER_CONNECTION);
-        keep_alive_ = p != end && case_equals(p->second, "Keep-Alive");
+        encoding_ = compressor::encoding_none;
+        if (options.compression && http11_ && compressor::available() && (h = view.header(header_accept_encoding)) != nullptr)
+        {
+            if (accepts_encoding(h->value, "gzip"))
+                encoding_ = compressor::encoding_gzip;
+            else if (accepts_encoding(h->value, "deflate"))
+                encoding_ = compressor::encoding_deflate;
+        }
 
-        request_.range_begin.reset();
-        request_.range_end.reset();
-        p = request_.headers.find(HEADER_RANGE);
-        if (p != end)
-            parse_range(p->second, request_.range_begin, request_.range_end);
+        request_.ranges.clear();
+        h = view.header(header_range);
+        if (h != nullptr)
+            parse_ranges(h->value, request_.ranges);
 
         // split url and queries
-        request_.queries.clear();
         auto pos = request_.url.find('?');
         if (pos != std::string::npos)
         {
-            std::string query = request_.url.substr(pos + 1);
-            request_.url = request_.url.substr(0, pos);
+            request_.queries.parse(std::string_view(request_.url).substr(pos + 1));
+            request_.url.resize(pos);
+        }
+        else
+            request_.queries.clear();
+
+        find_router();
 
-            std::regex re("&");
-            std::vector<std::string> vec(std::sregex_token_iterator(query.begin(), query.end(), re, -1), std::sregex_token_iterator());
-            for (auto& s : vec)
+        request_.headers.clear();
+        if (router_->copy_headers && !router_->captured_headers.empty())
+        {
+            for (auto& name : router_->captured_headers)
             {
-                auto pos2 = s.find('=');
-                if (pos2 != std::string::npos)
-                    request_.queries[s.substr(0, pos2)] = uri::decode(s.substr(pos2 + 1));
-                else
-                    request_.queries[s] = "";
+                if (case_equals(name, HEADER_REMOTE_ADDRESS))
+                    request_.headers[name] = peer_address_;
+                else if ((h = view.header(name)) != nullptr)
+                    request_.headers[name] = h->value;
             }
         }
+        else if (router_->copy_headers)
+        {
+            for (auto& f : view.headers)
+                request_.headers[std::string(f.name)] = f.value;
+            request_.headers[HEADER_REMOTE_ADDRESS] = peer_address_;
+        }
+
+        trace("%p:%p begin: %s\n", this, socket_, request_.url.c_str());
+        set_timeout(worker_->server_->options_.body_timeout);
+        return !router_->on_start || router_->on_start(request_);
+    }
+
+    void find_router()
+    {
+        router_ = &_not_found_router_;
+        request_.params.clear();
+        route_params_.clear();
 
-        auto p2 = router_map_.find(request_.url);
-        if (p2 != router_map_.cend())
+        int id = server_.route_tree_->find(request_.method, request_.url, route_params_);
+        if (id >= 0)
         {
-            router_ = p2->second;
+            for (auto& p : route_params_)
+                request_.params[std::string(p.first)] = uri::decode(p.second);
         }
-        else for (auto& p3 : router_list_)
+        else for (auto& r : server_.regex_routes_)
         {
-            if (std::regex_match(request_.url, p3.first))
+            if ((r.method.empty() || case_equals(r.method, request_.method)) && std::regex_match(request_.url, r.regex))
             {
-                router_ = p3.second;
+                id = r.id;
                 break;
             }
         }
 
-        trace("%p:%p begin: %s\n", this, socket_, request_.url.c_str());
-        return !router_.on_start || router_.on_start(request_);
+        if (id >= 0)
+            router_ = &server_.routers_[id];
     }
 
     virtual bool on_content_received(const char* data, size_t size)
     {
-        return !router_.on_data || router_.on_data(data, size);
+        set_timeout(worker_->server_->options_.body_timeout);
+        return !router_->on_data || router_->on_data(data, size);
     }
 
     virtual void on_read_end(int error_code)
     {
-        uv_read_stop(socket_);
-
+        // keep reading the pipelined requests while outputing
         if (state_ == state_parsed && error_code >= 0)
             on_route();
         else if (state_ != state_outputing)
+        {
+            uv_read_stop(socket_);
             on_end(error_code, reason_read_done);
+        }
     }
 
     void on_route()
@@ -171,12 +649,17 @@ protected:
         // set default status
         clear_response();
 
-        if (router_.on_route)
+        if (router_->on_route && router_->executor)
+        {
+            route_on_executor();
+            return;
+        }
+
+        if (router_->on_route)
         {
-            request_.headers[HEADER_REMOTE_ADDRESS] = peer_address_;
             response_.status_code = 200;
-            router_.on_route(request_, response_);
-            if (!response_.provider)
+            router_->on_route(request_, response_);
+            if (!response_.provider && !deferred_)
                 response_.content_length = 0;
         }
         else
@@ -184,144 +667,653 @@ protected:
             response_.content_length = 0;
             response_.status_code = 404;
         }
-        start_write();
-    }
 
-    void start_write()
-    {
-        string_map& headers = response_.headers;
+        // request_.view is not valid after this
+        request_.view.clear();
+        unpin_buffer();
 
-        if (case_equals(request_.method, "HEAD"))
-        {
-            content_written_ = content_to_write_ = 0; // to be done
-            response_.content_length = 0;
-        }
-        else if (response_.content_length)
+        if (deferred_)
         {
-            int64_t length = response_.content_length.value();
-            int64_t length_1 = length - 1;
-            if (request_.has_range())
-            {
-                int64_t range_end = std::min(request_.range_end.value_or(length_1), length_1);
-                headers[HEADER_CONTENT_RANGE] = std::string("bytes ") + std::to_string(request_.range_begin.value()) + '-' + std::to_string(range_end) + '/' + std::to_string(length);
-                response_.status_code = 206;
-            }
-
-            int64_t read_end = request_.range_end.value_or(length_1) + 1;
-            content_written_ = request_.range_begin.value_or(0);
-            content_to_write_ = std::min(read_end, length);
-            response_.content_length = content_to_write_ - content_written_;
+            // buffer the pipelined requests until resume()
+            state_ = state_outputing;
+            set_timeout(worker_->server_->options_.write_timeout);
         }
         else
-        {
-            content_written_ = 0;
-            content_to_write_ = INT64_MAX;
-        }
+            start_write();
+    }
 
-        if (response_.content_length)
+    // the router returns without the response, which is completed before resume()
+    void defer()
+    {
+        deferred_ = true;
+        aquire();
+    }
+
+    // writes the deferred response if the connection is not ended
+    void resume()
+    {
+        if (deferred_)
         {
-            if (!headers.count(HEADER_CONTENT_LENGTH))
-                headers[HEADER_CONTENT_LENGTH] = std::to_string(response_.content_length.value());
-            if (!headers.count(HEADER_ACCEPT_RANGES))
-                headers[HEADER_ACCEPT_RANGES] = "bytes";
+            deferred_ = false;
+            if (!response_.provider)
+                response_.content_length = 0;
+            start_write();
         }
+        release();
+    }
 
-        if (!headers.count(HEADER_SERVER))
-            headers[HEADER_SERVER] = LIBHTTP_TAG;
+    std::shared_ptr<deferred_response> defer_response()
+    {
+        // complete() may be called in other threads
+        loop* loop = worker_->loop_;
+        if (deferred_ || loop->prepare_async() != 0)
+            return nullptr;
 
-        if (!headers.count(HEADER_CONNECTION))
-            headers[HEADER_CONNECTION] = keep_alive_ ? "Keep-Alive" : "Close";
+        defer();
+        return std::shared_ptr<deferred_response>(new deferred_response(loop, this));
+    }
 
-        if (response_.status_msg.empty())
-        {
-            auto p = server::status_messages.find(response_.status_code);
-            if (p != server::status_messages.cend())
-                response_.status_msg = p->second;
-            else
-                response_.status_msg = "Done";
-        }
+    // the response is made in a thread of the executor, then moved to response_ in the loop thread
+    void route_on_executor()
+    {
+        request_.view.clear();
+        unpin_buffer();
+
+        defer();
+        state_ = state_outputing;
+        set_timeout(worker_->server_->options_.write_timeout);
 
-        auto pstr = std::make_shared<std::string>();
-        std::string& str = *pstr.get();
-        str.reserve(buffer_pool::buffer_size);
+        loop* loop = worker_->loop_;
+        auto res = std::make_shared<response2>();
+        res->status_code = 200;
+        const router* router = router_;
+        const request2* req = &request_;
+        bool posted = loop->prepare_async() == 0 && router->executor->post(loop, [router, req, res]() {
+            router->on_route(*req, *res);
+        }, [this, res]() {
+            complete([res](response2& response) {
+                _responser* responser = response.responser_;
+                response = std::move(*res);
+                response.responser_ = responser;
+            });
+        });
 
-        str.append("HTTP/1.1 ", 9);
-        str.append(std::to_string(response_.status_code));
-        str.append(" ", 1);
-        str.append(response_.status_msg);
-        str.append(" \r\n", 3);
-        for (auto& p : headers)
+        if (!posted)
         {
-            str.append(p.first);
-            str.append(": ", 2);
-            str.append(p.second);
-            str.append("\r\n", 2);
+            complete([](response2& response) {
+                response.status_code = 503;
+            });
         }
-        str.append("\r\n", 2);
-
-        state_ = state_outputing;
-        content_writer::start_write(pstr, response_.provider);
     }
 
-    void clear_response()
+    // by deferred_response in the loop thread, never inside the router which checks deferred_ after it returns
+    void complete(const std::function<void(response2& res)>& fill)
     {
-        response_.status_msg.clear();
-        response_.headers.clear();
-        response_.content_length.reset();
-        response_.provider = nullptr;
-        response_.releaser = nullptr;
+        if (deferred_ && fill)
+            fill(response_);
+        resume();
     }
 
-    virtual void on_write_end(int error_code)
+    // holds a reference until resume_read(), as the handler may resume after the connection ended
+    void pause_read()
     {
-        on_end(error_code, reason_write_done);
+        if (paused_ || state_ != state_parsed || is_read_done())
+            return;
+        paused_ = true;
+        aquire();
+        uv_read_stop(socket_);
     }
 
-    void on_end(int error_code, _end_reason reason)
+    void resume_read()
     {
-        if (response_.releaser)
-        {
-            response_.releaser();
-            response_.releaser = nullptr;
-        }
-        clear_response();
+        if (!paused_)
+            return;
+        paused_ = false;
 
-        if (error_code != 0)
-            keep_alive_ = false;
-        if (keep_alive_)
+        // the body may be completed by the data read before paused, or the connection ended meanwhile
+        if (socket_ != nullptr && state_ == state_parsed && !is_read_done())
         {
-            trace("%p:%p alive%d: %s, %s, %d\n", this, socket_, reason, error_code == 0 ? "DONE" : uv_err_name(error_code), request_.url.c_str(), ref_count_);
-
-            if (start_read(socket_) == 0)
-                return;
+            set_timeout(worker_->server_->options_.body_timeout);
+            int r = uv_read_start(socket_, on_alloc_cb, on_read_cb);
+            if (r < 0 && r != UV_EALREADY)
+                on_end(r, reason_read_done);
         }
-        trace("%p:%p end%d: %s, %s, %d\n", this, socket_, reason, error_code == 0 ? "DONE" : uv_err_name(error_code), request_.url.c_str(), ref_count_);
-
-        state_ = state_none;
-        assert(ref_count_ == 1);
         release();
     }
-};
 
-server::server(bool use_default) : loop(use_default)
-{
-    buffer_pool_ = std::make_shared<buffer_pool>();
-    port_ = 0;
-    socket_ = nullptr;
-}
+    // compressible by the Content-Type
+    static bool is_compressible(const string_map& headers)
+    {
+        auto p = headers.find(HEADER_CONTENT_TYPE);
+        if (p == headers.cend())
+            return false;
+        const std::string& type = p->second;
+        return type.compare(0, 5, "text/") == 0 || type.find("json") != std::string::npos
+            || type.find("javascript") != std::string::npos || type.find("xml") != std::string::npos;
+    }
 
-server::~server()
+    // replaces the provider by the compressed one, or by the cached content compressed before.
+    // HEAD gets the same headers as GET, without compressing
+    bool compress_response()
+    {
+        const server_options& options = server_.options_;
+        int64_t length = response_.content_length.value_or(-1);
+        bool head = case_equals(request_.method, "HEAD");
+        if (encoding_ == compressor::encoding_none || !response_.provider || response_.status_code != 200
+            || request_.has_range() || (length >= 0 && length < options.compression_min_size)
+            || response_.headers.count(HEADER_CONTENT_ENCODING) || !is_compressible(response_.headers))
+            return false;
+
+        // the same path, ETag and encoding is the same compressed content, an ETag is of one resource only
+        std::string key;
+        const char* encoding = compressor::name(encoding_);
+        auto etag = response_.headers.find(HEADER_ETAG);
+        if (etag != response_.headers.end() && length >= 0)
+            key = request_.url + '\n' + etag->second + encoding;
+
+        auto cached = key.empty() || head ? nullptr : worker_->compressed_cache_.find(key);
+        if (head)
+            response_.content_length.reset();
+        else if (cached)
+        {
+            response_.content_length = cached->size();
+            response_.provider = [cached](int64_t offset, int64_t length, content_sink sink) {
+                sink(cached->data() + offset, (size_t)(length - offset), [cached]() {});
+            };
+        }
+        else
+        {
+            auto c = compressor::create(worker_->loop_, encoding_, options.compression_level, response_.provider, length);
+            if (!c)
+                return false;
+            if (!key.empty())
+            {
+                c->set_on_finished(options.compression_cache_size, [worker = worker_, key](std::shared_ptr<std::string> content) {
+                    worker->compressed_cache_.insert(key, content);
+                });
+            }
+            response_.content_length.reset();
+            response_.provider = [c](int64_t offset, int64_t length, content_sink sink) {
+                c->provide(sink);
+            };
+        }
+
+        // a validator of its own, "xyz" to "xyz-gzip"
+        if (etag != response_.headers.end() && !etag->second.empty() && etag->second.back() == '"')
+            etag->second.insert(etag->second.size() - 1, std::string("-") + encoding);
+        response_.headers[HEADER_CONTENT_ENCODING] = encoding;
+        response_.headers[HEADER_VARY] = HEADER_ACCEPT_ENCODING;
+        response_.headers.erase(HEADER_CONTENT_LENGTH);
+        response_.sendfile_fd = -1;
+        return true;
+    }
+
+    // multipart/byteranges of the provider, the parts are provided by it without buffering, returns the length
+    int64_t provide_byteranges(const std::vector<std::pair<int64_t, int64_t>>& ranges, int64_t length)
+    {
+        // the parts between the headers of parts, which are kept as text
+        struct segment
+        {
+            int64_t offset;         // in the multipart body
+            int64_t size;
+            int64_t content_offset; // -1 for text
+            std::string text;
+        };
+
+        char boundary[32];
+        snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long)uv_hrtime());
+        std::string content_type;
+        auto p = response_.headers.find(HEADER_CONTENT_TYPE);
+        if (p != response_.headers.cend())
+            content_type = HEADER_CONTENT_TYPE + ": " + p->second + "\r\n";
+
+        auto segments = std::make_shared<std::vector<segment>>();
+        int64_t offset = 0;
+        auto add = [&segments, &offset](int64_t size, int64_t content_offset, std::string text) {
+            segments->push_back({ offset, size, content_offset, std::move(text) });
+            offset += size;
+        };
+        for (auto& range : ranges)
+        {
+            std::string head = std::string(offset == 0 ? "--" : "\r\n--") + boundary + "\r\n" + content_type
+                + "Content-Range: bytes " + std::to_string(range.first) + '-' + std::to_string(range.second) + '/' + std::to_string(length) + "\r\n\r\n";
+            add(head.size(), -1, head);
+            add(range.second + 1 - range.first, range.first, std::string());
+        }
+        std::string tail = std::string("\r\n--") + boundary + "--\r\n";
+        add(tail.size(), -1, tail);
+
+        response_.headers[HEADER_CONTENT_TYPE] = std::string("multipart/byteranges; boundary=") + boundary;
+        response_.sendfile_fd = -1;
+        response_.provider = [segments, provider = response_.provider](int64_t offset, int64_t length, content_sink sink) {
+            auto p = std::upper_bound(segments->begin(), segments->end(), offset, [](int64_t offset, const segment& s) {
+                return offset < s.offset;
+            }) - 1;
+            int64_t skip = offset - p->offset;
+            int64_t left = p->size - skip;
+            if (p->content_offset < 0)
+            {
+                sink(p->text.data() + skip, (size_t)left, [segments]() {});
+                return;
+            }
+
+            // not beyond the part
+            provider(p->content_offset + skip, p->content_offset + p->size, [sink, left](const char* data, size_t size, content_done done) {
+                if (data != nullptr && (int64_t)size > left)
+                    size = (size_t)left;
+                return sink(data, size, done);
+            });
+        };
+        return offset;
+    }
+
+    void start_write()
+    {
+        const string_map& headers = response_.headers;
+        std::optional<std::pair<int64_t, int64_t>> content_range;
+        bool unsatisfiable = false;
+        int64_t length = 0;
+        bool compressed = compress_response();
+
+        if (case_equals(request_.method, "HEAD"))
+        {
+            content_written_ = content_to_write_ = 0; // to be done
+            if (compressed)
+                response_.content_length.reset(); // unknown until compressed, as GET
+            else
+                response_.content_length = 0;
+        }
+        else if (response_.status_code == 304)
+        {
+            // no content, nor Content-Length
+            content_written_ = content_to_write_ = 0;
+            response_.content_length.reset();
+        }
+        else if (response_.content_length)
+        {
+            length = response_.content_length.value();
+            content_written_ = 0;
+            content_to_write_ = length;
+            if (request_.has_range() && response_.status_code == 200)
+            {
+                auto& ranges = worker_->ranges_;
+                resolve_ranges(request_.ranges, length, ranges);
+                if (ranges.empty())
+                {
+                    unsatisfiable = true;
+                    response_.status_code = 416;
+                    response_.provider = nullptr;
+                    response_.sendfile_fd = -1;
+                    content_to_write_ = 0;
+                }
+                else if (ranges.size() == 1)
+                {
+                    response_.status_code = 206;
+                    content_range = ranges.front();
+                    content_written_ = ranges.front().first;
+                    content_to_write_ = ranges.front().second + 1;
+                }
+                else
+                {
+                    response_.status_code = 206;
+                    content_to_write_ = provide_byteranges(ranges, length);
+                }
+            }
+            response_.content_length = content_to_write_ - content_written_;
+        }
+        else
+        {
+            content_written_ = 0;
+            content_to_write_ = INT64_MAX;
+        }
+        // the content of unknown length ends by the last chunk for HTTP/1.1, or by closing the connection
+        chunked_ = content_to_write_ == INT64_MAX && http11_ && !headers.count(HEADER_TRANSFER_ENCODING);
+        if (content_to_write_ == INT64_MAX && !chunked_)
+            keep_alive_ = false;
+
+        // the status line, the headers and the default headers below
+        size_t size = response_.status_msg.size() + 256;
+        for (auto& p : headers)
+            size += p.first.size() + p.second.size() + 4;
+
+        uv_buf_t buf;
+        std::shared_ptr<buffer_pool> pool = worker_->header_pool_;
+        if (!pool->get_buffer(size, buf))
+        {
+            on_write_end(UV_ENOMEM);
+            return;
+        }
+
+        char* p = buf.base;
+        auto append = [&p](std::string_view s) {
+            memcpy(p, s.data(), s.size());
+            p += s.size();
+        };
+        auto append_int = [&p](int64_t i) {
+            p = std::to_chars(p, p + 20, i).ptr;
+        };
+
+        if (response_.status_msg.empty())
+            append(worker_->status_line(response_.status_code));
+        else
+        {
+            append("HTTP/1.1 ");
+            append_int(response_.status_code);
+            append(" ");
+            append(response_.status_msg);
+            append("\r\n");
+        }
+
+        for (auto& h : headers)
+        {
+            append(h.first);
+            append(": ");
+            append(h.second);
+            append("\r\n");
+        }
+
+        if (response_.content_length)
+        {
+            if (!headers.count(HEADER_CONTENT_LENGTH))
+            {
+                append("Content-Length: ");
+                append_int(response_.content_length.value());
+                append("\r\n");
+            }
+            if (!headers.count(HEADER_ACCEPT_RANGES))
+                append("Accept-Ranges: bytes\r\n");
+        }
+
+        if (chunked_)
+            append("Transfer-Encoding: chunked\r\n");
+
+        if (content_range)
+        {
+            append("Content-Range: bytes ");
+            append_int(content_range->first);
+            append("-");
+            append_int(content_range->second);
+            append("/");
+            append_int(length);
+            append("\r\n");
+        }
+        else if (unsatisfiable)
+        {
+            append("Content-Range: bytes */");
+            append_int(length);
+            append("\r\n");
+        }
+
+        if (!headers.count(HEADER_SERVER))
+        {
+            append("Server: ");
+            append(LIBHTTP_TAG);
+            append("\r\n");
+        }
+
+        auto connection = headers.find(HEADER_CONNECTION);
+        if (connection == headers.cend())
+            append(keep_alive_ ? "Connection: Keep-Alive\r\n" : "Connection: Close\r\n");
+        else if (!is_persistent(1, connection->second))
+            keep_alive_ = false; // closed by the router
+
+        if (!headers.count(HEADER_DATE))
+        {
+            append("Date: ");
+            append(worker_->date());
+            append("\r\n");
+        }
+        append("\r\n");
+
+        state_ = state_outputing;
+        set_timeout(worker_->server_->options_.write_timeout);
+        int r = content_writer::start_write(buf.base, p - buf.base, [pool, buf]() mutable {
+            pool->recycle_buffer(buf);
+        }, response_.provider, response_.content_length ? response_.sendfile_fd : -1);
+        if (r < 0)
+            on_write_end(r);
+    }
+
+    void clear_response()
+    {
+        response_.status_msg.clear();
+        response_.headers.clear();
+        response_.content_length.reset();
+        response_.provider = nullptr;
+        response_.releaser = nullptr;
+        response_.sendfile_fd = -1;
+    }
+
+    virtual void on_write_progress()
+    {
+        set_timeout(worker_->server_->options_.write_timeout);
+    }
+
+    virtual void on_write_end(int error_code)
+    {
+        on_end(error_code, reason_write_done);
+    }
+
+    void on_end(int error_code, _end_reason reason)
+    {
+        if (response_.releaser)
+        {
+            response_.releaser();
+            response_.releaser = nullptr;
+        }
+        clear_response();
+
+        if (error_code != 0)
+            keep_alive_ = false;
+        if (keep_alive_)
+        {
+            trace("%p:%p alive%d: %s, %s, %d\n", this, socket_, reason, error_code == 0 ? "DONE" : uv_err_name(error_code), request_.url.c_str(), ref_count_);
+
+            idle_ = true;
+            set_timeout(worker_->server_->options_.keep_alive_timeout);
+            if (start_read(socket_) == 0)
+                return;
+        }
+        worker_->timing_wheel_->cancel(this);
+        trace("%p:%p end%d: %s, %s, %d\n", this, socket_, reason, error_code == 0 ? "DONE" : uv_err_name(error_code), request_.url.c_str(), ref_count_);
+
+        state_ = state_none;
+        deferred_ = false;
+        if (ref_count_ > 1)
+        {
+            // a deferred response not completed yet or a paused request, closes the socket now and this
+            // is freed by the resume() of them, which does nothing else then
+            close_socket();
+        }
+        release();
+    }
+};
+
+const std::string& _worker::status_line(int status_code)
 {
+    auto p = status_lines_.find(status_code);
+    if (p != status_lines_.cend())
+        return p->second;
+
+    auto m = server::status_messages.find(status_code);
+    std::string line = "HTTP/1.1 " + std::to_string(status_code) + ' ' + (m != server::status_messages.cend() ? m->second : "Done") + "\r\n";
+    return status_lines_[status_code] = std::move(line);
+}
+
+std::string_view _worker::date()
+{
+    uint64_t now = uv_now(loop_->get_loop());
+    if (date_size_ == 0 || now - date_updated_ >= 1000)
+    {
+        date_updated_ = now;
+        date_size_ = format_http_date(time(nullptr), date_);
+    }
+    return std::string_view(date_, date_size_);
+}
+
+std::shared_ptr<_file_info> _worker::find_file_info(const std::string& path)
+{
+    auto p = file_infos_.find(path);
+    if (p == file_infos_.cend())
+        return nullptr;
+
+    if (p->second->expires > uv_now(loop_->get_loop()))
+        return p->second;
+    file_infos_.erase(p);
+    return nullptr;
+}
+
+void _worker::add_file_info(const std::shared_ptr<_file_info>& info)
+{
+    uint32_t ttl = server_->options_.file_info_ttl;
+    if (ttl == 0 || info->fd < 0)
+        return;
+
+    // every entry holds an fd, so drop the expired ones before growing over the limit
+    uint64_t now = uv_now(loop_->get_loop());
+    if (file_infos_.size() >= server_->options_.file_cache_entries)
+    {
+        for (auto p = file_infos_.begin(); p != file_infos_.end();)
+        {
+            if (p->second->expires <= now)
+                p = file_infos_.erase(p);
+            else
+                ++p;
+        }
+        if (file_infos_.size() >= server_->options_.file_cache_entries)
+            return;
+    }
+
+    info->expires = server_->options_.watch_files && watch_dir(info->path) ? UINT64_MAX : now + ttl;
+    file_infos_[info->path] = info;
+}
+
+void _worker::remove_cache(const std::string& path)
+{
+    file_infos_.erase(path);
+    file_cache_.erase(path);
+}
+
+bool _worker::watch_dir(const std::string& path)
+{
+    auto pos = path.find_last_of("/\\");
+    std::string prefix = pos != std::string::npos ? path.substr(0, pos + 1) : std::string();
+    if (dir_watchers_.count(prefix))
+        return true;
+
+    _dir_watcher* watcher = new _dir_watcher();
+    watcher->worker = this;
+    watcher->prefix = prefix;
+    uv_fs_event_init(loop_->get_loop(), &watcher->handle);
+    uv_handle_set_data((uv_handle_t*)&watcher->handle, watcher);
+    int r = uv_fs_event_start(&watcher->handle, on_dir_changed_cb, prefix.empty() ? "." : prefix.c_str(), 0);
+    if (r != 0)
+    {
+        // out of inotify watches, the files expire by file_info_ttl
+        trace("watch %s: %s\n", prefix.c_str(), uv_err_name(r));
+        uv_close((uv_handle_t*)&watcher->handle, [](uv_handle_t* handle) {
+            delete (_dir_watcher*)uv_handle_get_data(handle);
+        });
+        return false;
+    }
+    dir_watchers_[prefix] = watcher;
+    return true;
+}
+
+void _worker::close_watchers()
+{
+    for (auto& p : dir_watchers_)
+    {
+        uv_close((uv_handle_t*)&p.second->handle, [](uv_handle_t* handle) {
+            delete (_dir_watcher*)uv_handle_get_data(handle);
+        });
+    }
+    dir_watchers_.clear();
+}
+
+void _worker::on_dir_changed(_dir_watcher* watcher, const char* filename, int status)
+{
+    if (status == 0 && filename != nullptr)
+    {
+        trace("changed %s%s\n", watcher->prefix.c_str(), filename);
+        std::string path = watcher->prefix + filename;
+        remove_cache(path);
+
+        // the file of a changed sidecar
+        std::string_view name = path;
+        if (name.size() > 3 && (name.substr(name.size() - 3) == ".br" || name.substr(name.size() - 3) == ".gz"))
+            remove_cache(path.substr(0, path.size() - 3));
+        return;
+    }
+
+    // can't tell which file changed, drop all of the directory and stop watching it
+    for (auto p = file_infos_.begin(); p != file_infos_.end();)
+    {
+        if (p->first.compare(0, watcher->prefix.size(), watcher->prefix) == 0)
+        {
+            file_cache_.erase(p->first);
+            p = file_infos_.erase(p);
+        }
+        else
+            ++p;
+    }
+    if (status < 0)
+    {
+        dir_watchers_.erase(watcher->prefix);
+        uv_close((uv_handle_t*)&watcher->handle, [](uv_handle_t* handle) {
+            delete (_dir_watcher*)uv_handle_get_data(handle);
+        });
+    }
+}
+
+void _worker::on_dir_changed_cb(uv_fs_event_t* handle, const char* filename, int events, int status)
+{
+    _dir_watcher* watcher = (_dir_watcher*)uv_handle_get_data((uv_handle_t*)handle);
+    watcher->worker->on_dir_changed(watcher, filename, status);
+}
+
+_worker::_worker(server* server, loop* loop)
+    : timing_wheel_(new timing_wheel(loop->get_loop())), file_cache_(server->options_.file_cache_size, server->options_.file_cache_entries),
+    compressed_cache_(server->options_.compression_cache_size)
+{
+    server_ = server;
+    loop_ = loop;
+    buffer_pool_ = std::make_shared<buffer_pool>();
+    header_pool_ = std::make_shared<buffer_pool>(_header_buffer_size_);
+}
+
+_worker::~_worker()
+{
+    file_infos_.clear(); // closes the fds on the loop
+    close_watchers();
     if (socket_ != nullptr)
-        uv_close((uv_handle_t*)socket_, on_closed_and_free_cb);
+        uv_close((uv_handle_t*)socket_, loop::on_closed_and_free_cb);
+    if (handoff_async_ != nullptr)
+        uv_close((uv_handle_t*)handoff_async_, loop::on_closed_and_free_cb);
+
+    if (loop_ != server_)
+    {
+        // the thread is stopped, end the connections left, the cancelled writes are called back by one more run
+        uv_walk(loop_->get_loop(), [](uv_handle_t* handle, void* arg) {
+            if (uv_handle_get_type(handle) == UV_TCP && uv_handle_get_data(handle) != nullptr && !uv_is_closing(handle))
+                ((_responser*)uv_handle_get_data(handle))->abort(UV_ECANCELED);
+        }, nullptr);
+        uv_run(loop_->get_loop(), UV_RUN_NOWAIT);
+    }
+
+    // all handles of this worker are closed now, ~loop runs until their close callbacks done
+    timing_wheel_.reset();
+    if (loop_ != server_)
+        delete loop_;
 }
 
-bool server::listen(const std::string& address, int port, int socket_type)
+bool _worker::listen(const sockaddr* addr, int socket_type, bool reuse_port)
 {
     if (socket_ == nullptr)
     {
         uv_tcp_t* tcp = (uv_tcp_t*)calloc(sizeof(uv_tcp_t), 1);
-        if (uv_tcp_init_ex(loop_, tcp, socket_type) != 0)
+        // the socket must be created before bind() to set SO_REUSEPORT
+        if (uv_tcp_init_ex(loop_->get_loop(), tcp, reuse_port && socket_type == 0 ? AF_INET : socket_type) != 0)
         {
             free(tcp);
             return false;
@@ -329,13 +1321,365 @@ bool server::listen(const std::string& address, int port, int socket_type)
         socket_ = (uv_stream_t*)tcp;
     }
 
+#ifdef SO_REUSEPORT
+    if (reuse_port)
+    {
+        uv_os_fd_t fd;
+        int on = 1;
+        if (uv_fileno((uv_handle_t*)socket_, &fd) != 0
+            || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0)
+            return false;
+    }
+#endif
+
+    uv_tcp_bind((uv_tcp_t*)socket_, addr, 0);
+    uv_handle_set_data((uv_handle_t*)socket_, this);
+    int r = uv_listen(socket_, server_->options_.backlog, on_connection_cb);
+    return r == 0;
+}
+
+bool _worker::start_thread()
+{
+    // loop::async() is called by other threads to stop or remove caches
+    if (loop_->prepare_async() != 0)
+        return false;
+
+#ifdef _ENABLE_HANDOFF_
+    if (handoff_async_ == nullptr)
+    {
+        uv_async_t* async = (uv_async_t*)calloc(sizeof(uv_async_t), 1);
+        if (uv_async_init(loop_->get_loop(), async, on_handoff_cb) != 0)
+        {
+            free(async);
+            return false;
+        }
+        uv_handle_set_data((uv_handle_t*)async, this);
+        handoff_async_ = async;
+    }
+#endif
+
+    thread_started_ = uv_thread_create(&thread_, thread_cb, this) == 0;
+    return thread_started_;
+}
+
+void _worker::stop_thread()
+{
+    if (!thread_started_)
+        return;
+
+    loop_->async([this]() {
+        if (socket_ != nullptr)
+        {
+            uv_close((uv_handle_t*)socket_, loop::on_closed_and_free_cb);
+            socket_ = nullptr;
+        }
+        if (handoff_async_ != nullptr)
+        {
+            uv_close((uv_handle_t*)handoff_async_, loop::on_closed_and_free_cb);
+            handoff_async_ = nullptr;
+        }
+        close_watchers();
+        loop_->stop_loop();
+    });
+    uv_thread_join(&thread_);
+    thread_started_ = false;
+}
+
+void _worker::thread_cb(void* arg)
+{
+    _worker* p_this = (_worker*)arg;
+    _local_worker_ = p_this;
+    p_this->loop_->run_loop();
+}
+
+void _worker::on_connection(uv_stream_t* socket)
+{
+    const server_options& options = server_->options_;
+    _worker* worker = server_->dispatch_worker();
+    bool overload = options.max_connections > 0 && worker->load() >= options.max_connections;
+    if (overload && options.overload == server_options::overload_pause)
+    {
+        // libuv stops polling the listen socket until the pending one is accepted,
+        // others are queued in the backlog
+        trace("accept paused: %d living connections\n", worker->load());
+        accept_paused_ = true;
+
+        // a connection closed before the flag is set doesn't resume, so look again after it
+        worker = server_->dispatch_worker();
+        if (worker->load() >= options.max_connections || !accept_paused_.exchange(false))
+            return;
+        trace("accept resumed: %d living connections\n", worker->load());
+        overload = false;
+    }
+
+    uv_tcp_t* tcp = (uv_tcp_t*)calloc(sizeof(uv_tcp_t), 1);
+    if (uv_tcp_init(loop_->get_loop(), tcp) != 0)
+    {
+        free(tcp);
+        return;
+    }
+    if (uv_accept(socket, (uv_stream_t*)tcp) != 0)
+    {
+        uv_close((uv_handle_t*)tcp, loop::on_closed_and_free_cb);
+        return;
+    }
+
+    if (overload)
+    {
+        reject(tcp);
+        return;
+    }
+    if (worker != this && worker->hand_over(tcp))
+        return;
+
+    uv_tcp_keepalive(tcp, 1, 60); // in seconds
+    (new _responser(this, (uv_stream_t*)tcp))->start();
+}
+
+void _worker::reject(uv_tcp_t* tcp)
+{
+    // the socket buffer of a new connection is empty, so try once is enough
+    uv_buf_t buf = uv_buf_init(const_cast<char*>(_overload_response_), sizeof(_overload_response_) - 1);
+    uv_try_write((uv_stream_t*)tcp, &buf, 1);
+    uv_close((uv_handle_t*)tcp, loop::on_closed_and_free_cb);
+}
+
+void _worker::on_connection_closed()
+{
+    // resume the paused accepting of this worker, or the acceptor's
+    _worker* acceptor = server_->options_.dispatch == server_options::dispatch_reuse_port ? this : server_->workers_.front();
+    if (!acceptor->accept_paused_.load() || !acceptor->accept_paused_.exchange(false))
+        return;
+
+    if (acceptor == this)
+    {
+        if (socket_ != nullptr)
+            on_connection(socket_);
+    }
+    else
+    {
+        acceptor->loop_->async([acceptor]() {
+            if (acceptor->socket_ != nullptr)
+                acceptor->on_connection(acceptor->socket_);
+        });
+    }
+}
+
+bool _worker::hand_over(uv_tcp_t* tcp)
+{
+#ifdef _ENABLE_HANDOFF_
+    // a handle can't move to other loop, so pass a duplicated socket and close the accepted one
+    uv_os_fd_t fd;
+    if (handoff_async_ == nullptr || uv_fileno((uv_handle_t*)tcp, &fd) != 0)
+        return false;
+
+    uv_os_sock_t sock = dup(fd);
+    if (sock < 0)
+        return false;
+    if (!handoff_queue_.push(sock))
+    {
+        close(sock);
+        return false;
+    }
+
+    handoff_count_++;
+    uv_close((uv_handle_t*)tcp, loop::on_closed_and_free_cb);
+    uv_async_send(handoff_async_);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void _worker::on_handoff()
+{
+    uv_os_sock_t sock;
+    while (handoff_queue_.pop(sock))
+    {
+        uv_tcp_t* tcp = (uv_tcp_t*)calloc(sizeof(uv_tcp_t), 1);
+        if (uv_tcp_init(loop_->get_loop(), tcp) != 0)
+        {
+            free(tcp);
+            tcp = nullptr;
+        }
+        else if (uv_tcp_open(tcp, sock) != 0)
+        {
+            uv_close((uv_handle_t*)tcp, loop::on_closed_and_free_cb);
+            tcp = nullptr;
+        }
+
+        if (tcp != nullptr)
+        {
+            uv_tcp_keepalive(tcp, 1, 60); // in seconds
+            (new _responser(this, (uv_stream_t*)tcp))->start();
+        }
+#ifdef _ENABLE_HANDOFF_
+        else
+            close(sock);
+#endif
+        handoff_count_--;
+    }
+}
+
+void _worker::on_handoff_cb(uv_async_t* handle)
+{
+    _worker* p_this = (_worker*)uv_handle_get_data((uv_handle_t*)handle);
+    if (p_this != nullptr)
+        p_this->on_handoff();
+}
+
+void _worker::on_connection_cb(uv_stream_t* socket, int status)
+{
+    _worker* p_this = (_worker*)uv_handle_get_data((uv_handle_t*)socket);
+    if (status == 0)
+        p_this->on_connection(socket);
+    else
+        trace("accept error: %d\n", status);
+}
+
+void request2::pause() const
+{
+    if (responser_ != nullptr)
+        responser_->pause_read();
+}
+
+void request2::resume() const
+{
+    if (responser_ != nullptr)
+        responser_->resume_read();
+}
+
+std::shared_ptr<deferred_response> response2::defer()
+{
+    return responser_ != nullptr ? responser_->defer_response() : nullptr;
+}
+
+deferred_response::deferred_response(class loop* loop, _responser* responser)
+{
+    loop_ = loop;
+    responser_ = responser;
+}
+
+deferred_response::~deferred_response()
+{
+    complete([](response2& res) {
+        res.status_code = 500;
+    });
+}
+
+void deferred_response::complete(std::function<void(response2& res)>&& fill)
+{
+    if (completed_.exchange(true))
+        return;
+
+    _responser* responser = responser_;
+    int r = loop_->async([responser, fill = std::move(fill)]() {
+        responser->complete(fill);
+    });
+    if (r != 0)
+        trace("deferred response %p: %s\n", responser, uv_err_name(r));
+}
+
+server::server(bool use_default) : loop(use_default)
+{
+    port_ = 0;
+    route_tree_ = std::make_shared<route_tree>();
+    workers_.push_back(new _worker(this, this));
+}
+
+server::~server()
+{
+    for (auto worker : workers_)
+        worker->stop_thread();
+
+    // the first one is the acceptor, which the others may resume when their connections end
+    for (auto p = workers_.rbegin(); p != workers_.rend(); p++)
+        delete *p;
+}
+
+_worker* server::local_worker() const
+{
+    // threads of other workers are always bound, so it is the server's loop thread
+    return _local_worker_ != nullptr ? _local_worker_ : workers_.front();
+}
+
+_worker* server::dispatch_worker()
+{
+    switch (options_.dispatch)
+    {
+    case server_options::dispatch_round_robin:
+    {
+        // skips the full workers, a full one is returned only if all are
+        int max_connections = options_.max_connections;
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+            next_worker_ = (next_worker_ + 1) % workers_.size();
+            if (max_connections <= 0 || workers_[next_worker_]->load() < max_connections)
+                break;
+        }
+        return workers_[next_worker_];
+    }
+
+    case server_options::dispatch_least_connections:
+    {
+        _worker* worker = workers_.front();
+        int load = worker->load();
+        for (size_t i = 1; i < workers_.size() && load > 0; i++)
+        {
+            int load2 = workers_[i]->load();
+            if (load2 < load)
+            {
+                worker = workers_[i];
+                load = load2;
+            }
+        }
+        return worker;
+    }
+
+    default:
+        return local_worker();
+    }
+}
+
+bool server::listen(const std::string& address, int port, int socket_type)
+{
     sockaddr_in addr;
     uv_ip4_addr(address.c_str(), port, &addr);
-    uv_tcp_bind((uv_tcp_t*)socket_, (const sockaddr*)&addr, 0);
+
+#ifndef _ENABLE_HANDOFF_
+    options_.dispatch = server_options::dispatch_reuse_port;
+#endif
+    int count = std::max(options_.worker_count, 1);
+#ifndef SO_REUSEPORT
+    if (options_.dispatch == server_options::dispatch_reuse_port)
+        count = 1;
+#endif
+    while ((int)workers_.size() < count)
+        workers_.push_back(new _worker(this, new loop(false)));
+    // the first worker was created before options were set
+    workers_.front()->file_cache_.set_limits(options_.file_cache_size, options_.file_cache_entries);
+    workers_.front()->compressed_cache_.set_limit(options_.compression_cache_size);
+
+    // only the first worker accepts if handing over sockets
+    bool reuse_port = workers_.size() > 1 && options_.dispatch == server_options::dispatch_reuse_port;
+    for (auto worker : workers_)
+    {
+        if (!worker->listen((const sockaddr*)&addr, socket_type, reuse_port))
+            return false;
+        if (!reuse_port)
+            break;
+    }
     port_ = addr.sin_port;
-    uv_handle_set_data((uv_handle_t*)socket_, this);
-    int r = uv_listen(socket_, 128, on_connection_cb);
-    return r == 0;
+
+    // workers call async() of the acceptor to resume accepting
+    if (workers_.size() > 1 && prepare_async() != 0)
+        return false;
+    for (size_t i = 1; i < workers_.size(); i++)
+    {
+        if (!workers_[i]->thread_started_ && !workers_[i]->start_thread())
+            return false;
+    }
+    return true;
 }
 
 void server::serve(const std::string& pattern, on_router&& on_route)
@@ -347,35 +1691,147 @@ void server::serve(const std::string& pattern, on_router&& on_route)
 
 void server::serve(const std::string& pattern, router router)
 {
-    auto p = router_map_.find(pattern);
-    if (p == router_map_.cend())
+    serve(std::string(), pattern, router);
+}
+
+void server::serve(const std::string& method, const std::string& pattern, on_router&& on_route)
+{
+    router router = {};
+    router.on_route = std::move(on_route);
+    serve(method, pattern, router);
+}
+
+void server::serve(const std::string& method, const std::string& pattern, router router)
+{
+    int id = (int)routers_.size();
+    // '.' is literal in the trie, "/index.html", unless it is of ".*"
+    if (pattern.find_first_of("\\^$|?+()[]{}") != std::string::npos || pattern.find(".*") != std::string::npos)
     {
-        router_map_.emplace(pattern, router);
-        router_list_.push_back(std::make_pair(std::regex(pattern), router));
+        for (auto& r : regex_routes_)
+        {
+            if (r.pattern == pattern && case_equals(r.method, method))
+                return;
+        }
+        regex_routes_.push_back({ method, pattern, std::regex(pattern), id });
     }
+    else if (!route_tree_->insert(method, pattern, id))
+        return;
+    routers_.push_back(router);
 }
 
 bool server::serve_file(const std::string& path, const request2& req, response2& res)
 {
-    uv_fs_t fs_req{};
-    int r = uv_fs_stat(loop_, &fs_req, path.c_str(), nullptr);
-    uint64_t length = fs_req.statbuf.st_size;
-    uv_fs_req_cleanup(&fs_req);
-    if (r != 0 || fs_req.result != 0 || !(fs_req.statbuf.st_mode & S_IFREG) || length == 0)
+    _worker* worker = local_worker();
+    auto info = worker->find_file_info(path);
+    if (info)
+        return serve_file(worker, info, _file_conditions(req), res);
+
+    info = std::make_shared<_file_info>(worker->loop_->get_loop(), path);
+    auto p = mime_types.find(file_extension(path));
+    if (p != mime_types.cend())
+        info->mime_type = p->second;
+    if (options_.precompressed)
+    {
+        static const char* encodings[][2] = { { ".br", "br" }, { ".gz", "gzip" } };
+        for (size_t i = 0; i < 2; i++)
+        {
+            auto sidecar = std::make_shared<_file_info>(info->loop, path + encodings[i][0]);
+            sidecar->mime_type = info->mime_type;
+            sidecar->content_encoding = encodings[i][1];
+            info->sidecars[i] = sidecar;
+        }
+    }
+
+    // watch before stat, not to miss a change in between
+    if (options_.watch_files)
+        worker->watch_dir(path);
+
+    _responser* responser = res.responser_;
+    if (responser == nullptr)
+    {
+        _file_opener::open(info, nullptr);
+        worker->add_file_info(info);
+        return serve_file(worker, info, _file_conditions(req), res);
+    }
+
+    // stat and open on the threadpool, not to block the loop on a cold disk
+    responser->defer();
+    _file_opener::open(info, [this, worker, responser, conditions = _file_conditions(req)](std::shared_ptr<_file_info> info) {
+        worker->add_file_info(info);
+        if (responser->deferred_)
+            serve_file(worker, info, conditions, responser->response_);
+        responser->resume();
+    });
+    return true;
+}
+
+bool server::serve_file(_worker* worker, const std::shared_ptr<_file_info>& info, const _file_conditions& conditions, response2& res)
+{
+    if (info->length == 0)
     {
         res.status_code = 404;
         return false;
     }
+    if (info->fd < 0)
+    {
+        res.status_code = 403;
+        return false;
+    }
+
+    if (info->sidecars[0] || info->sidecars[1])
+    {
+        res.headers[HEADER_VARY] = HEADER_ACCEPT_ENCODING;
+        for (auto& sidecar : info->sidecars)
+        {
+            if (sidecar && accepts_encoding(conditions.accept_encoding, sidecar->content_encoding))
+                return serve_file(worker, sidecar, conditions, res);
+        }
+    }
 
     std::shared_ptr<file_map> fmap;
-    if (length <= INT32_MAX)
+    uint64_t length = info->length;
+    int64_t sendfile_min_size = options_.sendfile_min_size;
+    bool use_sendfile = sendfile_min_size >= 0 && length >= (uint64_t)sendfile_min_size;
+    if (length <= INT32_MAX && !use_sendfile)
     {
-        long modified_time = fs_req.statbuf.st_mtim.tv_sec;
-        auto p = file_cache_.find(path);
-        if (p != file_cache_.cend() && p->second->modified_time() == modified_time)
-            fmap = p->second;
+        auto& file_cache = worker->file_cache_;
+        fmap = file_cache.find(info->path);
+        if (!fmap || fmap->modified_time() != info->modified_time)
+        {
+            fmap = std::make_shared<file_map>(info->fd, (size_t)length, info->modified_time);
+            if (fmap->ptr() != nullptr)
+                file_cache.insert(info->path, fmap);
+            else
+                file_cache.erase(info->path);
+        }
+    }
+
+    // the content hash is made on the threadpool, the inode, size and mtime are used until it is done
+    bool hashing = options_.etag_content_hash && fmap && fmap->ptr() != nullptr && !info->etag_hashed;
+    uint64_t hash = hashing ? fmap->content_hash(worker->loop_) : 0;
+    if (hash != 0 || info->etag.empty())
+    {
+        char etag[64];
+        if (hash != 0)
+            snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)hash);
         else
-            file_cache_[path] = fmap = std::make_shared<file_map>(path, (size_t)length, modified_time);
+            snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"", (unsigned long long)info->inode,
+                        (unsigned long long)info->length, (unsigned long long)info->modified_time);
+        info->etag = etag;
+        info->etag_hashed = hash != 0;
+    }
+    res.headers[HEADER_ETAG] = info->etag;
+    res.headers[HEADER_LAST_MODIFIED] = info->last_modified;
+
+    // before the provider, nothing to send if the client has it
+    std::string_view matched;
+    if (conditions.is_not_modified(*info, &matched))
+    {
+        // the validator of the compressed variant if the client has that
+        if (!matched.empty())
+            res.headers[HEADER_ETAG] = matched;
+        res.status_code = conditions.safe ? 304 : 412;
+        return true;
     }
 
     if (fmap && fmap->ptr() != nullptr)
@@ -390,14 +1846,12 @@ bool server::serve_file(const std::string& path, const request2& req, response2&
     }
     else
     {
-        auto reader = std::make_shared<file_reader>(loop_, path, buffer_pool_);
-        if (reader->get_fd() < 0)
-        {
-            res.status_code = 403;
-            return false;
-        }
+        // the fd is kept open by info, which may be shared with other requests
+        auto reader = std::make_shared<file_reader>(worker->loop_->get_loop(), info->fd, worker->buffer_pool_);
         res.content_length = length;
-        res.provider = [reader](int64_t offset, int64_t length, content_sink sink) {
+        if (use_sendfile)
+            res.sendfile_fd = info->fd;
+        res.provider = [reader, info](int64_t offset, int64_t length, content_sink sink) {
             size_t size = std::min(buffer_pool::buffer_size, (size_t)(length - offset));
             int r = reader->request_chunk(offset, size, sink);
             if (r < 0 && r != UV_EAGAIN)
@@ -405,67 +1859,77 @@ bool server::serve_file(const std::string& path, const request2& req, response2&
         };
     }
 
-    std::string ext = file_extension(path);
-    auto p = mime_types.find(ext);
-    if (p != mime_types.cend())
-        res.headers[http::HEADER_CONTENT_TYPE] = p->second;
+    if (!info->mime_type.empty())
+        res.headers[http::HEADER_CONTENT_TYPE] = info->mime_type;
+    if (!info->content_encoding.empty())
+        res.headers[HEADER_CONTENT_ENCODING] = info->content_encoding;
     return true;
 }
 
-void server::on_connection(uv_stream_t* socket)
+bool server::remove_cache(const std::string& path)
 {
-    uv_tcp_t* tcp = (uv_tcp_t*)calloc(sizeof(uv_tcp_t), 1);
-    if (uv_tcp_init(loop_, tcp) != 0)
-    {
-        free(tcp);
-        return;
-    }
-    if (uv_accept(socket, (uv_stream_t*)tcp) == 0)
+    bool removed = false;
+    for (auto worker : workers_)
     {
-        uv_tcp_keepalive(tcp, 1, 60); // in seconds
-        (new _responser(loop_, (uv_stream_t*)tcp, buffer_pool_, router_map_, router_list_))->start();
-    }
-    else
-    {
-        uv_close((uv_handle_t*)tcp, on_closed_and_free_cb);
+        if (worker == _local_worker_ || (worker == workers_.front() && (void*)uv_thread_self() == loop_thread_))
+        {
+            worker->file_infos_.erase(path);
+            removed |= worker->file_cache_.erase(path);
+        }
+        else
+        {
+            int r = worker->loop_->async([=]() {
+                worker->remove_cache(path);
+            });
+            removed |= r == 0;
+        }
     }
+    return removed;
 }
 
-void server::on_connection_cb(uv_stream_t* socket, int status)
+void server::remove_cache(const std::vector<std::string>& paths)
 {
-    server* p_this = (server*)uv_handle_get_data((uv_handle_t*)socket);
-    if (status == 0)
-        p_this->on_connection(socket);
-    else
-        trace("accept error: %d\n", status);
+    for_each_worker([paths](_worker* worker) {
+        for (const auto& path : paths)
+            worker->remove_cache(path);
+    });
 }
 
-bool server::remove_cache(const std::string& path)
+void server::pin_cache(const std::string& path, bool pinned)
 {
-    if ((void*)uv_thread_self() == loop_thread_)
-        return file_cache_.erase(path) != 0;
-    else
-    {
-        int r = async([=]() {
-            file_cache_.erase(path);
-        });
-        return r == 0;
-    }
+    for_each_worker([path, pinned](_worker* worker) {
+        worker->file_cache_.pin(path, pinned);
+    });
 }
 
-void server::remove_cache(const std::vector<std::string>& paths)
+file_cache_stats server::cache_stats() const
 {
-    if ((void*)uv_thread_self() == loop_thread_)
+    file_cache_stats stats;
+    for (auto worker : workers_)
     {
-        for (const auto& path : paths)
-            file_cache_.erase(path);
+        auto s = worker->file_cache_.stats();
+        stats.hits += s.hits;
+        stats.misses += s.misses;
+        stats.evictions += s.evictions;
+        stats.entries += s.entries;
+        stats.bytes += s.bytes;
     }
-    else
+    return stats;
+}
+
+void server::for_each_worker(std::function<void(_worker*)>&& func)
+{
+    // the caches of a worker are only touched in its own loop thread
+    for (auto worker : workers_)
     {
-        async([=]() {
-            for (const auto& path : paths)
-                file_cache_.erase(path);
-        });
+        if (worker == _local_worker_ || (worker == workers_.front() && (void*)uv_thread_self() == loop_thread_))
+            func(worker);
+        else
+        {
+            worker->loop_->async([worker, func]() {
+                func(worker);
+            });
+        }
     }
 }
 
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <uv.h>
+#include "timing-wheel.h"
+
+namespace http
+{
+
+timing_wheel::entry::~entry()
+{
+    if (wheel_ != nullptr)
+        wheel_->cancel(this);
+}
+
+timing_wheel::timing_wheel(uv_loop_t* loop, uint64_t tick, size_t slot_count)
+{
+    loop_ = loop;
+    tick_ = tick > 0 ? tick : 1;
+    slot_count_ = slot_count > 0 ? slot_count : 1;
+    slots_.reset(new link[slot_count_]);
+
+    timer_ = (uv_timer_t*)calloc(sizeof(uv_timer_t), 1);
+    uv_timer_init(loop_, timer_);
+    uv_handle_set_data((uv_handle_t*)timer_, this);
+    // the scheduled entries should keep the loop alive by themselves
+    uv_unref((uv_handle_t*)timer_);
+}
+
+timing_wheel::~timing_wheel()
+{
+    for (size_t i = 0; i < slot_count_; i++)
+    {
+        link* head = &slots_[i];
+        while (head->next != head)
+        {
+            entry* e = static_cast<entry*>(head->next);
+            unlink(e);
+            e->wheel_ = nullptr;
+        }
+    }
+
+    uv_timer_stop(timer_);
+    uv_handle_set_data((uv_handle_t*)timer_, nullptr);
+    uv_close((uv_handle_t*)timer_, [](uv_handle_t* handle) {
+        free(handle);
+    });
+}
+
+void timing_wheel::schedule(entry* e, uint64_t timeout)
+{
+    if (entry_count_ == 0 && e->wheel_ == nullptr)
+    {
+        // restart the ticks from now
+        uv_update_time(loop_);
+        start_time_ = uv_now(loop_);
+        current_tick_ = 0;
+        uv_timer_start(timer_, on_tick_cb, tick_, tick_);
+    }
+
+    uint64_t ticks = (timeout + tick_ - 1) / tick_;
+    uint64_t expire_tick = current_tick_ + (ticks > 0 ? ticks : 1);
+    if (e->wheel_ == this && e->expire_tick_ == expire_tick)
+        return;
+
+    if (e->wheel_ != nullptr)
+        unlink(e);
+    else
+        entry_count_++;
+
+    e->wheel_ = this;
+    e->expire_tick_ = expire_tick;
+    link_tail(&slots_[expire_tick % slot_count_], e);
+}
+
+void timing_wheel::cancel(entry* e)
+{
+    if (e->wheel_ != this)
+        return;
+
+    unlink(e);
+    e->wheel_ = nullptr;
+    if (--entry_count_ == 0)
+        uv_timer_stop(timer_);
+}
+
+void timing_wheel::on_tick()
+{
+    // catch up the ticks delayed by a busy loop
+    uint64_t target_tick = (uv_now(loop_) - start_time_) / tick_;
+    while (current_tick_ < target_tick && entry_count_ > 0)
+    {
+        current_tick_++;
+
+        // move the expired to a local list first, callbacks may cancel or schedule others
+        link expired;
+        link* head = &slots_[current_tick_ % slot_count_];
+        for (link* l = head->next; l != head;)
+        {
+            link* next = l->next;
+            if (static_cast<entry*>(l)->expire_tick_ <= current_tick_)
+            {
+                unlink(l);
+                link_tail(&expired, l);
+            }
+            l = next;
+        }
+
+        while (expired.next != &expired)
+        {
+            entry* e = static_cast<entry*>(expired.next);
+            cancel(e);
+            e->on_timeout();
+        }
+    }
+}
+
+void timing_wheel::on_tick_cb(uv_timer_t* handle)
+{
+    timing_wheel* p_this = (timing_wheel*)uv_handle_get_data((uv_handle_t*)handle);
+    if (p_this != nullptr)
+        p_this->on_tick();
+}
+
+void timing_wheel::unlink(link* l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->prev = l->next = l;
+}
+
+void timing_wheel::link_tail(link* head, link* l)
+{
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+} // namespace http
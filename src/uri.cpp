@@ -61,10 +61,11 @@ bool uri::parse(const std::string& url)
     return true;
 }
 
-std::string uri::decode(const std::string& s)
+std::string uri::decode(std::string_view s)
 {
     const size_t size = s.size();
     std::string result;
+    result.reserve(size);
     for (size_t i = 0; i < size; i++)
     {
         if (s[i] == '%' && i + 1 < size)
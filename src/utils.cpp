@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <regex>
 #include "common.h"
 #include "utils.h"
@@ -37,7 +39,7 @@ std::string file_extension(const std::string& path)
     return std::string();
 }
 
-bool from_hex_to_i(const std::string& s, size_t i, size_t cnt, int& val)
+bool from_hex_to_i(std::string_view s, size_t i, size_t cnt, int& val)
 {
     if (i >= s.size())
     {
@@ -47,7 +49,7 @@ bool from_hex_to_i(const std::string& s, size_t i, size_t cnt, int& val)
     val = 0;
     for (; cnt; i++, cnt--)
     {
-        if (!s[i])
+        if (i >= s.size() || !s[i])
         {
             return false;
         }
@@ -64,23 +66,84 @@ bool from_hex_to_i(const std::string& s, size_t i, size_t cnt, int& val)
     return true;
 }
 
-bool parse_range(const std::string& s, std::optional<int64_t>& begin, std::optional<int64_t>& end)
+bool parse_ranges(std::string_view s, std::vector<byte_range>& ranges)
 {
-    if (s.empty())
-        return false;
+    static const size_t max_ranges = 64;
 
-    size_t pos = s.find_first_of("=-");
-    if (pos == std::string::npos)
+    ranges.clear();
+    size_t pos = s.find('=');
+    if (pos == std::string_view::npos || !case_equals(s.substr(0, pos), "bytes"))
         return false;
-    else if (s[pos] == '=')
-        return parse_range(s.substr(pos + 1), begin, end);
-
-    std::string s1 = s.substr(0, pos);
-    std::string s2 = s.substr(pos + 1);
-    begin = strtoll(s1.c_str(), nullptr, 10);
-    if (!s2.empty())
-        end = strtoll(s2.c_str(), nullptr, 10);
-    return true;
+    s.remove_prefix(pos + 1);
+
+    auto number = [](std::string_view n, std::optional<int64_t>& val) {
+        while (!n.empty() && n.front() == ' ')
+            n.remove_prefix(1);
+        while (!n.empty() && n.back() == ' ')
+            n.remove_suffix(1);
+        if (n.empty())
+            return true;
+        int64_t i = 0;
+        auto r = std::from_chars(n.data(), n.data() + n.size(), i);
+        if (r.ec != std::errc() || r.ptr != n.data() + n.size())
+            return false;
+        val = i;
+        return true;
+    };
+
+    while (!s.empty())
+    {
+        size_t end = s.find(',');
+        std::string_view item = s.substr(0, end);
+        s = end != std::string_view::npos ? s.substr(end + 1) : std::string_view();
+        if (item.find_first_not_of(' ') == std::string_view::npos)
+            continue;
+
+        byte_range range;
+        size_t dash = item.find('-');
+        if (dash == std::string_view::npos || !number(item.substr(0, dash), range.first) || !number(item.substr(dash + 1), range.last)
+            || (!range.first && !range.last) || (range.first && range.last && range.last.value() < range.first.value())
+            || ranges.size() >= max_ranges)
+        {
+            ranges.clear();
+            return false;
+        }
+        ranges.push_back(range);
+    }
+    return !ranges.empty();
+}
+
+void resolve_ranges(const std::vector<byte_range>& ranges, int64_t length, std::vector<std::pair<int64_t, int64_t>>& resolved)
+{
+    resolved.clear();
+    for (auto& range : ranges)
+    {
+        int64_t first, last;
+        if (range.first)
+        {
+            first = range.first.value();
+            last = std::min(range.last.value_or(length - 1), length - 1);
+        }
+        else
+        {
+            // the last n bytes
+            first = std::max(length - range.last.value(), (int64_t)0);
+            last = range.last.value() > 0 ? length - 1 : -1;
+        }
+        if (first < length && first <= last)
+            resolved.emplace_back(first, last);
+    }
+
+    std::sort(resolved.begin(), resolved.end());
+    size_t n = 0;
+    for (size_t i = 0; i < resolved.size(); i++)
+    {
+        if (n > 0 && resolved[i].first <= resolved[n - 1].second + 1)
+            resolved[n - 1].second = std::max(resolved[n - 1].second, resolved[i].second);
+        else
+            resolved[n++] = resolved[i];
+    }
+    resolved.resize(n);
 }
 
 size_t to_utf8(int code, char* buf)
@@ -128,4 +191,110 @@ size_t to_utf8(int code, char* buf)
     return 0;
 }
 
+size_t format_http_date(time_t time, char* buf)
+{
+    static const char* days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+    static const char* months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+    struct tm tm = {};
+#ifdef _WIN32
+    gmtime_s(&tm, &time);
+#else
+    gmtime_r(&time, &tm);
+#endif
+    int n = snprintf(buf, 30, "%s, %02d %s %04d %02d:%02d:%02d GMT", days[tm.tm_wday], tm.tm_mday,
+                        months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+    return n > 0 ? (size_t)n : 0;
+}
+
+bool parse_http_date(std::string_view s, time_t& time)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (s.size() != 29 || s[3] != ',' || s.substr(25) != " GMT")
+        return false;
+
+    int day = 0, year = 0, hour = 0, minute = 0, second = 0;
+    auto digits = [&s](size_t i, size_t cnt, int& val) {
+        val = 0;
+        for (size_t n = i + cnt; i < n; i++)
+        {
+            if (s[i] < '0' || s[i] > '9')
+                return false;
+            val = val * 10 + (s[i] - '0');
+        }
+        return true;
+    };
+    if (!digits(5, 2, day) || !digits(12, 4, year) || !digits(17, 2, hour) || !digits(20, 2, minute) || !digits(23, 2, second))
+        return false;
+
+    std::string_view month = s.substr(8, 3);
+    int mon = 0;
+    while (mon < 12 && month != std::string_view(months + mon * 3, 3))
+        mon++;
+    if (mon == 12)
+        return false;
+
+    // days since the epoch of the civil date
+    int y = year - (mon < 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mon + (mon > 1 ? -2 : 10)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+
+    time = (time_t)(days * 86400 + hour * 3600 + minute * 60 + second);
+    return true;
+}
+
+bool accepts_encoding(std::string_view accept_encoding, std::string_view coding)
+{
+    // the coding itself takes precedence over "*", e.g. "*, gzip;q=0"
+    bool any = false;
+    while (!accept_encoding.empty())
+    {
+        size_t end = accept_encoding.find(',');
+        std::string_view item = accept_encoding.substr(0, end);
+        accept_encoding = end != std::string_view::npos ? accept_encoding.substr(end + 1) : std::string_view();
+
+        size_t semicolon = item.find(';');
+        std::string_view name = item.substr(0, semicolon);
+        while (!name.empty() && name.front() == ' ')
+            name.remove_prefix(1);
+        while (!name.empty() && name.back() == ' ')
+            name.remove_suffix(1);
+        if (!case_equals(name, coding) && name != "*")
+            continue;
+
+        size_t q = semicolon != std::string_view::npos ? item.find("q=", semicolon) : std::string_view::npos;
+        bool accepted = q == std::string_view::npos || strtod(std::string(item.substr(q + 2)).c_str(), nullptr) > 0;
+        if (name != "*")
+            return accepted;
+        any = accepted;
+    }
+    return any;
+}
+
+bool is_persistent(int minor_version, std::string_view connection)
+{
+    bool keep_alive = false;
+    while (!connection.empty())
+    {
+        size_t end = connection.find(',');
+        std::string_view option = connection.substr(0, end);
+        connection = end != std::string_view::npos ? connection.substr(end + 1) : std::string_view();
+
+        while (!option.empty() && option.front() == ' ')
+            option.remove_prefix(1);
+        while (!option.empty() && option.back() == ' ')
+            option.remove_suffix(1);
+        if (case_equals(option, "close"))
+            return false;
+        if (case_equals(option, "keep-alive"))
+            keep_alive = true;
+    }
+    return keep_alive || minor_version >= 1;
+}
+
 } // namespace http
\ No newline at end of file